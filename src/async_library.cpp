@@ -0,0 +1,222 @@
+#include <filesystem>
+
+#include "async_library.h"
+#include "library_reader.h"
+#include "parallel.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = workerCount(SIZE_MAX);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    threads_.emplace_back([this]() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        wake_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+      }
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+Executor& defaultExecutor() {
+  static ThreadPool pool;
+  return pool;
+}
+
+
+// Shared between the LibraryLoad and the task producing its events.
+class LibraryLoad::State {
+public:
+  explicit State(Executor* resume_executor) : resume_executor_(resume_executor) {}
+
+  void push(LoadEvent event) {
+    finish([&]() { events_.push_back(std::move(event)); }, event.kind == LoadEvent::Kind::kDone);
+  }
+
+  void fail(std::exception_ptr error) {
+    finish([&]() { error_ = error; }, true);
+  }
+
+  bool abandoned() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return abandoned_;
+  }
+
+  void abandon() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abandoned_ = true;
+    events_.clear();
+  }
+
+  // Returns true if next() can return without waiting.
+  bool ready() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return readyLocked();
+  }
+
+  // Returns false (don't suspend) if an event arrived since ready() was checked.
+  bool wait(std::coroutine_handle<> waiter) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (readyLocked()) {
+      return false;
+    }
+    waiter_ = waiter;
+    return true;
+  }
+
+  std::optional<LoadEvent> next() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!events_.empty()) {
+      LoadEvent event = std::move(events_.front());
+      events_.pop_front();
+      return event;
+    }
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+    return std::nullopt;
+  }
+
+private:
+  bool readyLocked() const {
+    return !events_.empty() || finished_;
+  }
+
+  // Applies update under the lock and then resumes the waiting coroutine, if any.
+  template<typename F>
+  void finish(F update, bool last) {
+    std::coroutine_handle<> waiter;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (abandoned_) {
+        return;
+      }
+      update();
+      finished_ = finished_ || last;
+      std::swap(waiter, waiter_);
+    }
+    if (!waiter) {
+      return;
+    }
+    if (resume_executor_) {
+      resume_executor_->post([waiter]() { waiter.resume(); });
+    } else {
+      waiter.resume();
+    }
+  }
+
+  Executor* resume_executor_;
+  std::mutex mutex_;
+  std::deque<LoadEvent> events_;
+  std::exception_ptr error_;
+  bool finished_ = false;
+  bool abandoned_ = false;
+  std::coroutine_handle<> waiter_;
+};
+
+LibraryLoad::~LibraryLoad() {
+  if (state_) {
+    state_->abandon();
+  }
+}
+
+bool LibraryLoad::NextAwaiter::await_ready() {
+  return state_->ready();
+}
+
+bool LibraryLoad::NextAwaiter::await_suspend(std::coroutine_handle<> waiter) {
+  return state_->wait(waiter);
+}
+
+std::optional<LoadEvent> LibraryLoad::NextAwaiter::await_resume() {
+  return state_->next();
+}
+
+
+namespace {
+
+// The body of the load task. Mirrors readLibrary, but publishes its progress through state.
+void loadLibrary(
+    const std::string& path, const ReadOptions& options, LibraryLoad::State* state) {
+  std::filesystem::path serato_dir_path = std::filesystem::path(path) / "_Serato_";
+
+  std::unique_ptr<DatabaseFile> database_file;
+  {
+    PhaseTimer timer(options, &LoadStats::database_seconds);
+    database_file =
+        readFromPath<DatabaseFile>((serato_dir_path / "database V2").native(), options);
+  }
+  std::shared_ptr<Library> tracks = std::make_shared<Library>(*database_file);
+  state->push(LoadEvent{LoadEvent::Kind::kTracks, tracks, nullptr});
+
+  std::vector<std::string> crate_paths;
+  {
+    PhaseTimer timer(options, &LoadStats::list_crates_seconds);
+    crate_paths = listCrateFiles((serato_dir_path / "Subcrates").native());
+  }
+
+  CrateReader crate_reader(database_file->tracks, options);
+  std::vector<Crate> crates;
+  for (const std::string& crate_path : crate_paths) {
+    if (state->abandoned()) {
+      return;
+    }
+    crates.push_back(crate_reader.read(crate_path));
+    state->push(
+        LoadEvent{LoadEvent::Kind::kCrate, nullptr, std::make_shared<const Crate>(crates.back())});
+  }
+
+  std::shared_ptr<Library> library = std::make_shared<Library>(*tracks);
+  {
+    PhaseTimer timer(options, &LoadStats::nest_seconds);
+    library->crates = nestCrates(std::move(crates));
+  }
+  state->push(LoadEvent{LoadEvent::Kind::kDone, library, nullptr});
+}
+
+}  // namespace
+
+
+LibraryLoad asyncReadLibrary(const std::string& path, const AsyncReadOptions& options) {
+  std::shared_ptr<LibraryLoad::State> state =
+      std::make_shared<LibraryLoad::State>(options.resume_executor);
+  Executor* executor = options.executor ? options.executor : &defaultExecutor();
+  ReadOptions read_options = options.read_options;
+  executor->post([path, read_options, state]() {
+    try {
+      loadLibrary(path, read_options, state.get());
+    } catch (...) {
+      state->fail(std::current_exception());
+    }
+  });
+  return LibraryLoad(state);
+}
@@ -0,0 +1,114 @@
+// This file contains asyncReadLibrary, a coroutine-friendly version of readLibrary that reports
+// the library as it loads. Unlike the rest of the library it needs C++20.
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "seratocrates.h"
+
+// Runs tasks somewhere. Implement this to run loads (or resume the coroutines waiting on them) on
+// your own event loop.
+class Executor {
+public:
+  virtual ~Executor() = default;
+  virtual void post(std::function<void()> task) = 0;
+};
+
+// An Executor that runs tasks on a fixed set of threads, in the order they're posted. The
+// destructor waits for posted tasks to finish.
+class ThreadPool : public Executor {
+public:
+  // threads defaults to the number of cores.
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool() override;
+
+  void post(std::function<void()> task) override;
+
+private:
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// The ThreadPool that asyncReadLibrary uses unless told otherwise. Created on first use.
+Executor& defaultExecutor();
+
+struct LoadEvent {
+  enum class Kind {
+    // The database has been read. library has all of the tracks and no crates.
+    kTracks,
+    // A crate has been read. crate is named the way Serato names its file ("Parent%%Child"), and
+    // has no subcrates. Crates arrive in order of name, each after its parent.
+    kCrate,
+    // The load is finished. library is the same as readLibrary would return, with crates nested,
+    // and shares its tracks with the kTracks event's library. This is always the last event.
+    kDone,
+  };
+
+  Kind kind;
+  std::shared_ptr<const Library> library;
+  std::shared_ptr<const Crate> crate;
+};
+
+struct AsyncReadOptions {
+  ReadOptions read_options;
+  // Where the load runs. Defaults to defaultExecutor(). The load is a single task.
+  Executor* executor = nullptr;
+  // Where coroutines waiting on LibraryLoad::next() are resumed, e.g. the UI thread's event loop.
+  // If null, they're resumed on whichever thread produced the event.
+  Executor* resume_executor = nullptr;
+};
+
+// A library load in progress, returned by asyncReadLibrary. Events are queued as the load
+// produces them, so none are missed if the caller is slow to ask for them.
+//
+// Destroying a LibraryLoad abandons the load: it stops at the next crate and its remaining events
+// are dropped.
+class LibraryLoad {
+public:
+  class State;
+
+  explicit LibraryLoad(std::shared_ptr<State> state) : state_(std::move(state)) {}
+  LibraryLoad(LibraryLoad&&) = default;
+  LibraryLoad& operator=(LibraryLoad&&) = default;
+  ~LibraryLoad();
+
+  class NextAwaiter {
+  public:
+    explicit NextAwaiter(State* state) : state_(state) {}
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> waiter);
+    std::optional<LoadEvent> await_resume();
+
+  private:
+    State* state_;
+  };
+
+  // co_await next() to get the next event. Returns std::nullopt once the kDone event has been
+  // returned. If the load failed, the exception it threw (e.g. ReadException) is rethrown here
+  // instead. Only one coroutine may wait at a time.
+  NextAwaiter next() {
+    return NextAwaiter(state_.get());
+  }
+
+private:
+  std::shared_ptr<State> state_;
+};
+
+// Starts loading the library at path (as for readLibrary) and returns immediately. If
+// options.read_options.stats is set, it's written from the load's thread and shouldn't be read
+// until the kDone event.
+LibraryLoad asyncReadLibrary(
+    const std::string& path, const AsyncReadOptions& options = AsyncReadOptions());
@@ -0,0 +1,516 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <thread>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define SERATOCRATES_HAVE_IO_URING 1
+#endif
+
+#include "batch_read.h"
+#include "parallel.h"
+#include "seratocrates.h"
+#include "tracer.h"
+
+namespace {
+
+// Reads are I/O-bound, so the fallback uses more threads than there are cores.
+const size_t kReadThreads = 16;
+
+// readFully reads at most this much per call, so that it can notice cancellation.
+const size_t kReadChunkBytes = 4 << 20;
+
+// Before rereading a file that changed while we read it, wait this long times the number of
+// attempts so far, to give the writer a chance to finish.
+const std::chrono::milliseconds kRetryDelay(20);
+
+FileVersion fileVersion(const struct stat& st) {
+  return {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+          static_cast<uint64_t>(st.st_size), st.st_mtim.tv_sec,
+          static_cast<uint32_t>(st.st_mtim.tv_nsec)};
+}
+
+// Reads size bytes (or fewer, if the file is shorter) from fd into data. Returns false on error,
+// and throws LoadCancelled if progress is cancelled.
+//
+// This uses pread at explicit offsets, so it doesn't depend on (or move) fd's file position.
+bool readFully(int fd, size_t size, std::string* data, const LoadProgress* progress) {
+  // Grow the string a chunk at a time rather than all at once, since zero-filling a large file's
+  // worth of fresh memory takes a while by itself.
+  data->reserve(size);
+  size_t got = 0;
+  while (got < size) {
+    checkCancelled(progress);
+    size_t chunk = std::min(size - got, kReadChunkBytes);
+    data->resize(got + chunk);
+    ssize_t n = pread(fd, data->data() + got, chunk, got);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    got += n;
+  }
+  data->resize(got);
+  return true;
+}
+
+// Reads the file at path into data and its version into version. Returns false if the file changed
+// while it was being read.
+bool readFileOnce(const std::string& path, std::string* data, FileVersion* version,
+                  const ReadOptions& options) {
+  int fd;
+  struct stat before;
+  struct stat after;
+  bool ok = false;
+  {
+    TraceSpan span(options.tracer, "open", path);
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw ReadException("Could not open file at path " + path);
+    }
+    ok = fstat(fd, &before) == 0;
+  }
+  try {
+    TraceSpan span(options.tracer, "read", path);
+    ok = ok && readFully(fd, before.st_size, data, options.progress) && fstat(fd, &after) == 0;
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  if (!ok) {
+    throw ReadException("Could not read file at path " + path);
+  }
+  *version = fileVersion(before);
+  return data->size() == static_cast<size_t>(before.st_size) && *version == fileVersion(after);
+}
+
+// Reads the file at path, reading it again if it changed while it was being read. Stores the
+// version that was read in version and adds the number of rereads to *retries.
+std::string readUnchangedFile(const std::string& path, FileVersion* version,
+                              const ReadOptions& options, uint64_t* retries) {
+  std::string data;
+  for (int attempt = 1; ; attempt++) {
+    checkCancelled(options.progress);
+    data.clear();
+    if (readFileOnce(path, &data, version, options)) {
+      return data;
+    }
+    if (attempt == kMaxReadAttempts) {
+      throw ReadException("File at path " + path + " kept changing while it was being read");
+    }
+    (*retries)++;
+    std::this_thread::sleep_for(kRetryDelay * attempt);
+  }
+}
+
+#ifdef SERATOCRATES_HAVE_IO_URING
+
+// A minimal io_uring wrapper. We talk to the kernel directly rather than through liburing to
+// avoid the dependency; we only need a handful of operations.
+class IoUring {
+public:
+  ~IoUring() {
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Returns false if io_uring isn't available or doesn't support all of ops.
+  bool init(unsigned entries, const std::vector<uint8_t>& ops) {
+    io_uring_params params{};
+    fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ < 0) {
+      return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      return false;
+    }
+    cq_ring_ = single_mmap
+        ? sq_ring_
+        : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return supports(ops);
+  }
+
+  unsigned entries() const {
+    return sq_entries_;
+  }
+
+  // Returns a zeroed submission queue entry. The caller must not queue more than entries()
+  // operations per submitAndWait().
+  io_uring_sqe* queue(uint8_t opcode, uint64_t user_data) {
+    unsigned index = pending_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &static_cast<io_uring_sqe*>(sqes_)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    pending_tail_++;
+    return sqe;
+  }
+
+  // Submits all queued operations and calls on_complete(user_data, result) for each of them as
+  // they finish. Returns once all of them have finished.
+  //
+  // Returns false if the kernel refused to take some of them. Those are dropped without calling
+  // on_complete, but this still waits for (and calls on_complete for) every operation the kernel
+  // did take, so that none of them is left writing into the caller's buffers.
+  template<typename F>
+  bool submitAndWait(F on_complete) {
+    unsigned to_submit = pending_tail_ - *sq_tail_;
+    __atomic_store_n(sq_tail_, pending_tail_, __ATOMIC_RELEASE);
+
+    bool ok = true;
+    unsigned remaining = to_submit;
+    while (remaining > 0) {
+      int ret = syscall(__NR_io_uring_enter, fd_, to_submit, 1, IORING_ENTER_GETEVENTS,
+                        nullptr, 0);
+      if (ret < 0 && errno != EINTR) {
+        if (to_submit == 0 || !(errno == EAGAIN || errno == EBUSY || errno == ENOMEM)) {
+          // Only submitting can fail for lack of resources. Anything else means the ring itself
+          // is unusable, and we can't know when the operations in flight will stop writing into
+          // the caller's buffers.
+          std::abort();
+        }
+        // Take back the entries the kernel hasn't consumed (we don't use SQPOLL, so nothing else
+        // reads the submission queue), and wait for the rest.
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+        pending_tail_ = head;
+        remaining -= to_submit;
+        to_submit = 0;
+        ok = false;
+        continue;
+      }
+      if (ret > 0) {
+        to_submit -= ret;
+      }
+
+      unsigned head = *cq_head_;
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        on_complete(cqe.user_data, cqe.res);
+        remaining--;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    return ok;
+  }
+
+private:
+  bool supports(const std::vector<uint8_t>& ops) {
+    std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+      return false;
+    }
+    for (uint8_t op : ops) {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  int fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  void* cq_ring_ = MAP_FAILED;
+  void* sqes_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned pending_tail_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+const unsigned kRingEntries = 64;
+
+FileVersion fileVersion(const struct statx& st) {
+  return {makedev(st.stx_dev_major, st.stx_dev_minor), st.stx_ino, st.stx_size,
+          st.stx_mtime.tv_sec, st.stx_mtime.tv_nsec};
+}
+
+// Reads paths[begin, end) into contents using ring. Each batch of files takes three submissions:
+// open and statx, then read, then another statx (of the open file) and close. Files that changed
+// between the two statx calls are read again with readUnchangedFile, which adds to *retries.
+// Returns false if io_uring failed (by which point every operation it took has finished and every
+// file it opened is closed); throws ReadException if a file couldn't be read.
+bool readBatch(IoUring* ring, const std::vector<std::string>& paths, size_t begin, size_t end,
+               std::vector<std::string>* contents, std::vector<FileVersion>* versions,
+               const ReadOptions& options, uint64_t* retries) {
+  size_t count = end - begin;
+  std::vector<int> fds(count, -1);
+  std::vector<struct statx> stats(count);
+  std::vector<int> errors(count, 0);
+
+  for (size_t i = 0; i < count; i++) {
+    io_uring_sqe* open = ring->queue(IORING_OP_OPENAT, 2 * i);
+    open->fd = AT_FDCWD;
+    open->addr = reinterpret_cast<uint64_t>(paths[begin + i].c_str());
+    open->open_flags = O_RDONLY | O_CLOEXEC;
+
+    io_uring_sqe* stat = ring->queue(IORING_OP_STATX, 2 * i + 1);
+    stat->fd = AT_FDCWD;
+    stat->addr = reinterpret_cast<uint64_t>(paths[begin + i].c_str());
+    stat->len = STATX_BASIC_STATS;
+    stat->off = reinterpret_cast<uint64_t>(&stats[i]);
+  }
+  bool ok = ring->submitAndWait([&](uint64_t user_data, int32_t res) {
+    size_t i = user_data / 2;
+    if (user_data % 2 == 0) {
+      fds[i] = res;
+    }
+    if (res < 0) {
+      errors[i] = -res;
+    }
+  });
+
+  // Reads can come back short (e.g. on network filesystems), in which case we queue another read
+  // for the rest.
+  std::vector<size_t> got(count, 0);
+  std::vector<size_t> pending;
+  for (size_t i = 0; ok && i < count; i++) {
+    if (errors[i] == 0) {
+      (*contents)[begin + i].resize(stats[i].stx_size);
+      pending.push_back(i);
+    }
+  }
+  while (ok && !pending.empty()) {
+    for (size_t i : pending) {
+      std::string& data = (*contents)[begin + i];
+      io_uring_sqe* read = ring->queue(IORING_OP_READ, i);
+      read->fd = fds[i];
+      read->addr = reinterpret_cast<uint64_t>(data.data() + got[i]);
+      read->len = data.size() - got[i];
+      read->off = got[i];
+    }
+    std::vector<size_t> next_pending;
+    ok = ring->submitAndWait([&](uint64_t i, int32_t res) {
+      if (res < 0) {
+        errors[i] = -res;
+      } else if (res == 0) {
+        // The file is shorter than statx said.
+        (*contents)[begin + i].resize(got[i]);
+      } else {
+        got[i] += res;
+        if (got[i] < (*contents)[begin + i].size()) {
+          next_pending.push_back(i);
+        }
+      }
+    });
+    pending.swap(next_pending);
+  }
+
+  // The statx and close for each file are hard-linked so that the close runs after the statx even
+  // if the statx fails. A failed statx is treated like a change, so the file gets reread.
+  std::vector<struct statx> stats_after(count);
+  std::vector<uint8_t> changed(count, false);
+  std::vector<uint8_t> closed(count, false);
+  size_t closes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (fds[i] >= 0) {
+      if (ok && errors[i] == 0) {
+        io_uring_sqe* stat = ring->queue(IORING_OP_STATX, 2 * i + 1);
+        stat->fd = fds[i];
+        stat->addr = reinterpret_cast<uint64_t>("");
+        stat->statx_flags = AT_EMPTY_PATH;
+        stat->len = STATX_BASIC_STATS;
+        stat->off = reinterpret_cast<uint64_t>(&stats_after[i]);
+        stat->flags = IOSQE_IO_HARDLINK;
+      }
+      ring->queue(IORING_OP_CLOSE, 2 * i)->fd = fds[i];
+      closes++;
+    }
+  }
+  bool all_closed = closes == 0 || ring->submitAndWait([&](uint64_t user_data, int32_t res) {
+    if (user_data % 2 == 1 && res < 0) {
+      changed[user_data / 2] = true;
+    }
+    if (user_data % 2 == 0) {
+      // The close released the descriptor even if it reports an error.
+      closed[user_data / 2] = true;
+    }
+  });
+  if (!all_closed) {
+    // Close the files whose closes the kernel didn't take. The others may already have been
+    // reused by another thread.
+    for (size_t i = 0; i < count; i++) {
+      if (fds[i] >= 0 && !closed[i]) {
+        close(fds[i]);
+      }
+    }
+    return false;
+  }
+
+  for (size_t i = 0; ok && i < count; i++) {
+    if (errors[i] != 0) {
+      throw ReadException(
+          std::string(fds[i] < 0 ? "Could not open file at path " : "Could not read file at path ")
+          + paths[begin + i]);
+    }
+    std::string& data = (*contents)[begin + i];
+    FileVersion& version = (*versions)[begin + i];
+    version = fileVersion(stats[i]);
+    if (changed[i] || data.size() != stats[i].stx_size || version != fileVersion(stats_after[i])) {
+      (*retries)++;
+      data = readUnchangedFile(paths[begin + i], &version, options, retries);
+    }
+  }
+  return ok;
+}
+
+// Returns false if io_uring isn't usable, in which case the caller should fall back to threads.
+bool readFilesIoUring(const std::vector<std::string>& paths, std::vector<std::string>* contents,
+                      std::vector<FileVersion>* versions, const ReadOptions& options,
+                      uint64_t* retries) {
+  IoUring ring;
+  if (!ring.init(kRingEntries, {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                                IORING_OP_CLOSE})) {
+    return false;
+  }
+  // Each file needs two entries in the first submission (open and statx).
+  size_t batch = ring.entries() / 2;
+  for (size_t begin = 0; begin < paths.size(); begin += batch) {
+    checkCancelled(options.progress);
+    size_t end = std::min(paths.size(), begin + batch);
+    std::string detail;
+    if (options.tracer) {
+      detail = std::to_string(end - begin) + " files from " + paths[begin];
+    }
+    TraceSpan span(options.tracer, "read batch", detail);
+    if (!readBatch(&ring, paths, begin, end, contents, versions, options, retries)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif  // SERATOCRATES_HAVE_IO_URING
+
+}  // namespace
+
+
+FileVersion fileVersion(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return FileVersion();
+  }
+  return fileVersion(st);
+}
+
+
+FileVersion fileVersion(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return FileVersion();
+  }
+  return fileVersion(st);
+}
+
+
+std::string readFile(const std::string& path, const ReadOptions& options, FileVersion* version) {
+  FileVersion ignored;
+  uint64_t retries = 0;
+  std::string data =
+      readUnchangedFile(path, version ? version : &ignored, options, &retries);
+  if (options.stats) {
+    options.stats->torn_read_retries += retries;
+  }
+  return data;
+}
+
+
+std::vector<std::string> readFiles(
+    const std::vector<std::string>& paths, const ReadOptions& options,
+    std::vector<FileVersion>* versions) {
+  std::vector<std::string> contents(paths.size());
+  std::vector<FileVersion> ignored;
+  if (!versions) {
+    versions = &ignored;
+  }
+  versions->assign(paths.size(), FileVersion());
+  uint64_t retries = 0;
+#ifdef SERATOCRATES_HAVE_IO_URING
+  bool done = readFilesIoUring(paths, &contents, versions, options, &retries);
+#else
+  bool done = false;
+#endif
+  if (!done) {
+    // Each file's retries are counted separately, since the files are read on several threads.
+    std::vector<uint64_t> file_retries(paths.size(), 0);
+    parallelFor(paths.size(), [&](size_t i) {
+      contents[i] = readUnchangedFile(paths[i], &(*versions)[i], options, &file_retries[i]);
+    }, kReadThreads);
+    for (uint64_t n : file_retries) {
+      retries += n;
+    }
+  }
+  if (options.stats) {
+    options.stats->torn_read_retries += retries;
+  }
+  return contents;
+}
@@ -0,0 +1,71 @@
+// This file contains functions for reading whole files into memory.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+// Throws LoadCancelled if progress is set and its load has been cancelled.
+inline void checkCancelled(const LoadProgress* progress) {
+  if (progress && progress->cancel) {
+    throw LoadCancelled("Load was cancelled");
+  }
+}
+
+// A file that keeps changing while we read it is read at most this many times before giving up.
+const int kMaxReadAttempts = 5;
+
+// The parts of a file's metadata that change when it's rewritten. If they're the same before and
+// after a read, we assume nobody wrote to the file in between.
+struct FileVersion {
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t size = 0;
+  int64_t mtime_seconds = 0;
+  uint32_t mtime_nanoseconds = 0;
+
+  bool operator==(const FileVersion& other) const {
+    return device == other.device && inode == other.inode && size == other.size
+        && mtime_seconds == other.mtime_seconds && mtime_nanoseconds == other.mtime_nanoseconds;
+  }
+
+  bool operator!=(const FileVersion& other) const {
+    return !(*this == other);
+  }
+};
+
+// Returns the current version of the file at path, or a default-constructed FileVersion (which
+// doesn't match any real file's) if it can't be stat'ed.
+FileVersion fileVersion(const std::string& path);
+
+// Returns the current version of the open file fd, or a default-constructed FileVersion if it can't
+// be stat'ed.
+FileVersion fileVersion(int fd);
+
+// Returns the contents of the file at path. Throws ReadException if it can't be read, or
+// LoadCancelled if options.progress is cancelled while it's being read (which is checked every few
+// megabytes).
+//
+// Serato rewrites its files in place, so a file can change while we're reading it and we'd get a
+// mix of old and new contents. To catch that, the file's inode, size and modification time are
+// compared before and after the read; if they differ, the file is read again (a few times at
+// most) and the reread is counted in options.stats->torn_read_retries. If version isn't null, the
+// version of the file that was read is stored there.
+std::string readFile(const std::string& path, const ReadOptions& options = ReadOptions(),
+                     FileVersion* version = nullptr);
+
+// Returns the contents of each file in paths, in the same order. Throws ReadException if any of
+// them can't be read, or LoadCancelled if options.progress is cancelled in the meantime (which is
+// checked between batches of files). Files that change while they're being read are read again
+// individually, as in readFile. If versions isn't null, it's filled in with the version of each
+// file that was read.
+//
+// On Linux this batches the opens, stats, reads and closes for many files into a few io_uring
+// submissions, which saves a lot of round trips on network filesystems. If io_uring isn't
+// available (or doesn't support the operations we need), the files are read on a pool of threads
+// instead.
+std::vector<std::string> readFiles(
+    const std::vector<std::string>& paths, const ReadOptions& options = ReadOptions(),
+    std::vector<FileVersion>* versions = nullptr);
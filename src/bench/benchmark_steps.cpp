@@ -0,0 +1,88 @@
+#include <filesystem>
+#include <memory>
+
+#include "benchmark_steps.h"
+#include "library_reader.h"
+#include "seratocrates.h"
+
+namespace {
+
+std::string databasePath(const BenchmarkLibrary& library) {
+  return (std::filesystem::path(library.root) / "_Serato_" / "database V2").native();
+}
+
+std::vector<std::string> cratePaths(const BenchmarkLibrary& library) {
+  return listCrateFiles(
+      (std::filesystem::path(library.root) / "_Serato_" / "Subcrates").native());
+}
+
+}  // namespace
+
+
+BenchmarkLibrary writeBenchmarkLibrary(const std::string& root, size_t tracks) {
+  std::filesystem::remove_all(root);
+  SyntheticLibraryOptions options;
+  options.tracks = tracks;
+  options.crates = 100;
+  BenchmarkLibrary ret;
+  ret.tracks = tracks;
+  ret.root = root;
+  ret.stats = writeSyntheticLibrary(root, options);
+  return ret;
+}
+
+
+const std::vector<BenchmarkStep>& benchmarkSteps() {
+  static const std::vector<BenchmarkStep> ret = {
+      {"read_database",
+       [](const BenchmarkLibrary& library) {
+         return StepRun{nullptr, [path = databasePath(library)]() {
+           readFromPath<DatabaseFile>(path);
+         }};
+       },
+       [](const BenchmarkLibrary& library) { return library.stats.database_bytes; },
+       [](const BenchmarkLibrary& library) { return library.tracks; },
+       "tracks"},
+      {"read_crates",
+       [](const BenchmarkLibrary& library) {
+         std::shared_ptr<DatabaseFile> database =
+             readFromPath<DatabaseFile>(databasePath(library));
+         return StepRun{nullptr, [database, paths = cratePaths(library)]() {
+           CrateReader reader(database->tracks);
+           for (const std::string& path : paths) {
+             reader.read(path);
+           }
+         }};
+       },
+       [](const BenchmarkLibrary& library) { return library.stats.crate_bytes; },
+       [](const BenchmarkLibrary& library) { return library.stats.crate_tracks; },
+       "crate_entries"},
+      {"nest_crates",
+       [](const BenchmarkLibrary& library) {
+         std::shared_ptr<DatabaseFile> database =
+             readFromPath<DatabaseFile>(databasePath(library));
+         auto crates = std::make_shared<std::vector<Crate>>();
+         CrateReader reader(database->tracks);
+         for (const std::string& path : cratePaths(library)) {
+           crates->push_back(reader.read(path));
+         }
+         // nestCrates consumes its input, so give it a fresh copy each time.
+         auto copy = std::make_shared<std::vector<Crate>>();
+         return StepRun{[crates, copy]() { *copy = std::vector<Crate>(*crates); },
+                        [database, copy]() { nestCrates(std::move(*copy)); }};
+       },
+       [](const BenchmarkLibrary&) { return size_t(0); },
+       [](const BenchmarkLibrary& library) { return library.stats.crate_tracks; },
+       "crate_entries"},
+      {"read_library",
+       [](const BenchmarkLibrary& library) {
+         return StepRun{nullptr, [root = library.root]() { readLibrary(root); }};
+       },
+       [](const BenchmarkLibrary& library) {
+         return library.stats.database_bytes + library.stats.crate_bytes;
+       },
+       [](const BenchmarkLibrary& library) { return library.tracks; },
+       "tracks"},
+  };
+  return ret;
+}
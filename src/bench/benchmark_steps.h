@@ -0,0 +1,45 @@
+// This file contains the steps of readLibrary that the benchmarks time, shared by
+// seratocrates_benchmark and check_benchmark_regressions so that the two measure the same thing.
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "synthetic_library.h"
+
+// A synthetic library on disk to run the steps against.
+struct BenchmarkLibrary {
+  size_t tracks = 0;
+  std::string root;
+  SyntheticLibraryStats stats;
+};
+
+// Writes the synthetic library with the given number of tracks that the benchmarks use to root,
+// replacing whatever is there.
+BenchmarkLibrary writeBenchmarkLibrary(const std::string& root, size_t tracks);
+
+// One repetition of a step, set up for a particular library.
+struct StepRun {
+  // Untimed work to do before each run (e.g. copying an input that run consumes). May be empty.
+  std::function<void()> prepare;
+  // The timed work.
+  std::function<void()> run;
+};
+
+struct BenchmarkStep {
+  // E.g. "read_database".
+  const char* name;
+  // Does the step's untimed setup (e.g. reading the database that crates are resolved against).
+  std::function<StepRun(const BenchmarkLibrary&)> setup;
+  // The input bytes that one run processes, or 0 if it doesn't read any.
+  std::function<size_t(const BenchmarkLibrary&)> bytes;
+  // The items that one run processes, and what they are: "tracks" or "crate_entries" (tracks
+  // listed in crates).
+  std::function<size_t(const BenchmarkLibrary&)> items;
+  const char* items_name;
+};
+
+// Reading and parsing the database, reading and resolving the crates, nesting the crates, and
+// the whole of readLibrary.
+const std::vector<BenchmarkStep>& benchmarkSteps();
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark_steps.h"
+
+// Usage:
+//   bazel run -c opt //src/bench:check_benchmark_regressions -- [--baseline=PATH] [--output=PATH]
+//       [--update_baseline] [--sizes=N,...] [--threshold=X] [--min_repetitions=N]
+// Runs the steps in benchmark_steps.h (as seratocrates_benchmark does) against synthetic libraries
+// of 1k, 50k and 500k tracks and compares each one's time and peak RSS against a baseline. Prints
+// a table of the results, and exits with status 1 if anything regressed (2 on other errors).
+//
+// Each benchmark runs in a child process of its own, so that its peak RSS (which includes any
+// setup, e.g. the database that read_crates resolves against) isn't mixed up with the others'.
+// It's repeated at least --min_repetitions times and for at least a second. Its time is the median
+// repetition's, and its peak RSS is the median of each repetition's peak (the peak is reset
+// between repetitions through /proc/self/clear_refs). The noise in each is the median absolute
+// deviation of the repetitions, relative to the median.
+//
+// A benchmark regressed if its time or peak RSS is more than max(threshold, 3 * noise) above the
+// baseline's, where noise is the larger of the two runs' noise. Runs on a busy machine can differ
+// by more than their own repetitions do, so a
+// benchmark that looks regressed is run again (up to kConfirmationRuns more times, each in a new
+// process) and only fails if every run regressed. Benchmarks that aren't in the baseline are
+// reported but never fail.
+//
+// --baseline: the baseline to compare against (default src/bench/benchmark_baseline.json).
+//   Relative paths are resolved against the workspace under bazel run, and the current directory
+//   otherwise.
+// --output: also write the results to PATH, in the same JSON format as the baseline.
+// --update_baseline: write the results to the baseline rather than comparing against it. Times
+//   are only comparable on the same machine, so record a new baseline when the machine changes.
+// --sizes: run only these library sizes (in tracks), e.g. --sizes=1000,50000.
+// --threshold: the smallest relative change treated as a regression (default 0.1).
+// --min_repetitions: default 5.
+
+namespace {
+
+const size_t kDefaultSizes[] = {1000, 50000, 500000};
+const double kMinSeconds = 1.0;
+const int kMaxRepetitions = 1000;
+const double kNoiseMultiple = 3;
+const int kConfirmationRuns = 2;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One benchmark's results, as stored in the JSON files.
+struct Result {
+  std::string name;
+  double median_seconds = 0;
+  double noise = 0;
+  int repetitions = 0;
+  double bytes_per_second = 0;
+  double items_per_second = 0;
+  double peak_rss_bytes = 0;
+  double rss_noise = 0;
+};
+
+// Runs fn in a child process and returns the string it returns. Stores the child's peak RSS in
+// peak_rss_bytes. Exits if the child fails.
+std::string runInChild(const std::function<std::string()>& fn, double* peak_rss_bytes) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(2);
+  }
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    int status = 0;
+    try {
+      std::string out = fn();
+      for (size_t written = 0; written < out.size();) {
+        ssize_t n = write(fds[1], out.data() + written, out.size() - written);
+        if (n <= 0) {
+          _exit(1);
+        }
+        written += n;
+      }
+    } catch (const std::exception& e) {
+      fprintf(stderr, "%s\n", e.what());
+      status = 1;
+    }
+    _exit(status);
+  }
+
+  close(fds[1]);
+  std::string ret;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      break;
+    }
+    ret.append(buffer, n);
+  }
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::cerr << "Benchmark process failed\n";
+    exit(2);
+  }
+  // ru_maxrss is in kilobytes on Linux.
+  *peak_rss_bytes = usage.ru_maxrss * 1024.0;
+  return ret;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t mid = values.size() / 2;
+  return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+BenchmarkLibrary writeLibrary(size_t tracks) {
+  const char* tmpdir = std::getenv("TEST_TMPDIR");
+  BenchmarkLibrary ret;
+  ret.tracks = tracks;
+  ret.root = (std::filesystem::path(tmpdir ? tmpdir : "/tmp")
+              / ("seratocrates_regressions_" + std::to_string(tracks))).native();
+  // Write the library in a child too, so that the generator's memory doesn't stay in this process
+  // (and in every benchmark process forked from it).
+  double unused;
+  std::istringstream stats(runInChild([&]() {
+    SyntheticLibraryStats stats = writeBenchmarkLibrary(ret.root, tracks).stats;
+    return std::to_string(stats.database_bytes) + ' ' + std::to_string(stats.crate_bytes) + ' '
+        + std::to_string(stats.crate_tracks);
+  }, &unused));
+  stats >> ret.stats.database_bytes >> ret.stats.crate_bytes >> ret.stats.crate_tracks;
+  return ret;
+}
+
+// Returns the median absolute deviation of values from their median m, relative to m.
+double relativeNoise(const std::vector<double>& values, double m) {
+  std::vector<double> deviations;
+  for (double value : values) {
+    deviations.push_back(std::abs(value - m));
+  }
+  return m > 0 ? median(deviations) / m : 0;
+}
+
+// Resets this process's peak RSS (VmHWM) to its current RSS. Returns false if the kernel doesn't
+// support that (it needs Linux 4.0).
+bool resetPeakRss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.close();
+  return bool(clear_refs);
+}
+
+// Returns this process's peak RSS in bytes, or 0 if it can't be read.
+double peakRss() {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      return std::strtod(line.c_str() + strlen("VmHWM:"), nullptr) * 1024;
+    }
+  }
+  return 0;
+}
+
+Result runBenchmark(const BenchmarkStep& step, const BenchmarkLibrary& library,
+                    int min_repetitions) {
+  Result ret;
+  ret.name = std::string(step.name) + '/' + std::to_string(library.tracks);
+  double process_peak_rss;
+  std::istringstream repetitions(runInChild([&]() {
+    StepRun run = step.setup(library);
+    // Returns how long one repetition's timed part took.
+    auto repetition = [&]() {
+      if (run.prepare) {
+        run.prepare();
+      }
+      auto start = std::chrono::steady_clock::now();
+      run.run();
+      return secondsSince(start);
+    };
+    // One untimed repetition first, to warm up caches and the allocator.
+    repetition();
+    std::ostringstream out;
+    out.precision(17);
+    double total = 0;
+    for (int i = 0; i < kMaxRepetitions && (i < min_repetitions || total < kMinSeconds); i++) {
+      bool reset = resetPeakRss();
+      double seconds = repetition();
+      total += seconds;
+      out << seconds << ' ' << (reset ? peakRss() : 0) << '\n';
+    }
+    return out.str();
+  }, &process_peak_rss));
+
+  std::vector<double> seconds;
+  std::vector<double> peaks;
+  for (double s, peak; repetitions >> s >> peak;) {
+    seconds.push_back(s);
+    peaks.push_back(peak);
+  }
+  ret.repetitions = seconds.size();
+  ret.median_seconds = median(seconds);
+  ret.noise = relativeNoise(seconds, ret.median_seconds);
+  if (*std::min_element(peaks.begin(), peaks.end()) > 0) {
+    ret.peak_rss_bytes = median(peaks);
+    ret.rss_noise = relativeNoise(peaks, ret.peak_rss_bytes);
+  } else {
+    // Fall back to the peak over the whole process.
+    ret.peak_rss_bytes = process_peak_rss;
+  }
+  if (ret.median_seconds > 0) {
+    ret.bytes_per_second = step.bytes(library) / ret.median_seconds;
+    ret.items_per_second = step.items(library) / ret.median_seconds;
+  }
+  return ret;
+}
+
+void writeResults(std::ostream& out, const std::vector<Result>& results) {
+  out.precision(9);
+  out << "{\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\""
+        << ", \"median_seconds\": " << r.median_seconds << ", \"noise\": " << r.noise
+        << ", \"repetitions\": " << r.repetitions << ", \"bytes_per_second\": "
+        << r.bytes_per_second << ", \"items_per_second\": " << r.items_per_second
+        << ", \"peak_rss_bytes\": " << r.peak_rss_bytes << ", \"rss_noise\": " << r.rss_noise
+        << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// Reads results written by writeResults. This isn't a general JSON parser: it only understands
+// what writeResults writes (one object per benchmark, with string and number values). Throws
+// std::runtime_error if the text isn't in that form, e.g. because it was truncated.
+std::map<std::string, Result> readResults(std::istream& in) {
+  std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  auto fail = [](const std::string& what) {
+    throw std::runtime_error("Bad baseline: " + what);
+  };
+  std::map<std::string, Result> ret;
+  size_t begin = text.find('[');
+  if (begin == std::string::npos) {
+    fail("no list of benchmarks");
+  }
+  while ((begin = text.find('{', begin)) != std::string::npos) {
+    size_t end = text.find('}', begin);
+    if (end == std::string::npos) {
+      fail("unterminated object");
+    }
+    Result result;
+    std::map<std::string, double> numbers;
+    for (size_t pos = begin; (pos = text.find('"', pos)) < end;) {
+      size_t key_end = text.find('"', pos + 1);
+      if (key_end >= end) {
+        fail("unterminated key");
+      }
+      std::string key = text.substr(pos + 1, key_end - pos - 1);
+      size_t value = text.find_first_not_of(" :", key_end + 1);
+      if (value >= end) {
+        fail("no value for " + key);
+      }
+      if (text[value] == '"') {
+        size_t value_end = text.find('"', value + 1);
+        if (value_end >= end) {
+          fail("unterminated value for " + key);
+        }
+        if (key == "name") {
+          result.name = text.substr(value + 1, value_end - value - 1);
+        }
+        pos = value_end + 1;
+      } else {
+        char* number_end;
+        numbers[key] = std::strtod(text.c_str() + value, &number_end);
+        pos = number_end - text.c_str();
+        if (pos == value || pos > end) {
+          fail("bad number for " + key);
+        }
+      }
+    }
+    if (result.name.empty()) {
+      fail("benchmark without a name");
+    }
+    result.median_seconds = numbers["median_seconds"];
+    result.noise = numbers["noise"];
+    result.repetitions = numbers["repetitions"];
+    result.bytes_per_second = numbers["bytes_per_second"];
+    result.items_per_second = numbers["items_per_second"];
+    result.peak_rss_bytes = numbers["peak_rss_bytes"];
+    result.rss_noise = numbers["rss_noise"];
+    ret[result.name] = result;
+    begin = end + 1;
+  }
+  return ret;
+}
+
+std::string formatSeconds(double seconds) {
+  char text[32];
+  if (seconds < 1e-3) {
+    snprintf(text, sizeof(text), "%.1f us", seconds * 1e6);
+  } else if (seconds < 1) {
+    snprintf(text, sizeof(text), "%.2f ms", seconds * 1e3);
+  } else {
+    snprintf(text, sizeof(text), "%.3f s", seconds);
+  }
+  return text;
+}
+
+std::string formatChange(double now, double before) {
+  char text[32];
+  snprintf(text, sizeof(text), "%+.1f%%", (now / before - 1) * 100);
+  return text;
+}
+
+// Prints result's row of the table, without a newline.
+void printResult(const Result& result) {
+  char line[256];
+  snprintf(line, sizeof(line), "%-22s %10s %6.1f%% %9.1f MiB", result.name.c_str(),
+           formatSeconds(result.median_seconds).c_str(), result.noise * 100,
+           result.peak_rss_bytes / (1 << 20));
+  std::cout << line;
+}
+
+// Continues result's row with how it compares to baseline, without a newline. Returns what
+// regressed ("time", "RSS" or "time, RSS"), or an empty string if nothing did.
+std::string compare(const Result& result, const Result& baseline, double threshold) {
+  double time_threshold =
+      std::max(threshold, kNoiseMultiple * std::max(result.noise, baseline.noise));
+  double rss_threshold =
+      std::max(threshold, kNoiseMultiple * std::max(result.rss_noise, baseline.rss_noise));
+  bool slower = result.median_seconds > baseline.median_seconds * (1 + time_threshold);
+  bool bigger =
+      result.peak_rss_bytes > baseline.peak_rss_bytes * (1 + rss_threshold);
+  char line[256];
+  snprintf(line, sizeof(line), "  time %7s (limit %+.1f%%)  RSS %7s",
+           formatChange(result.median_seconds, baseline.median_seconds).c_str(),
+           time_threshold * 100,
+           formatChange(result.peak_rss_bytes, baseline.peak_rss_bytes).c_str());
+  std::cout << line;
+  return slower ? bigger ? "time, RSS" : "time" : bigger ? "RSS" : "";
+}
+
+std::string resolvePath(const std::string& path) {
+  const char* workspace = std::getenv("BUILD_WORKSPACE_DIRECTORY");
+  if (!workspace || std::filesystem::path(path).is_absolute()) {
+    return path;
+  }
+  return (std::filesystem::path(workspace) / path).native();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string baseline_path = "src/bench/benchmark_baseline.json";
+  std::string output_path;
+  bool update_baseline = false;
+  std::vector<size_t> sizes(std::begin(kDefaultSizes), std::end(kDefaultSizes));
+  double threshold = 0.1;
+  int min_repetitions = 5;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string flag = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    if (flag == "--baseline") {
+      baseline_path = value;
+    } else if (flag == "--output") {
+      output_path = value;
+    } else if (arg == "--update_baseline") {
+      update_baseline = true;
+    } else if (flag == "--sizes") {
+      sizes.clear();
+      std::istringstream list(value);
+      for (std::string item; std::getline(list, item, ',');) {
+        char* end;
+        sizes.push_back(std::strtoull(item.c_str(), &end, 10));
+        if (item.empty() || *end) {
+          std::cerr << "Bad --sizes " << value << '\n';
+          return 2;
+        }
+      }
+    } else if (flag == "--threshold") {
+      threshold = std::strtod(value, nullptr);
+    } else if (flag == "--min_repetitions") {
+      min_repetitions = std::max(1, std::atoi(value));
+    } else {
+      std::cerr << "Unknown flag " << arg << '\n';
+      return 2;
+    }
+  }
+  baseline_path = resolvePath(baseline_path);
+
+  std::map<std::string, Result> baseline;
+  if (!update_baseline) {
+    std::ifstream in(baseline_path);
+    if (!in) {
+      std::cerr << "Could not read baseline " << baseline_path
+                << " (record one with --update_baseline)\n";
+      return 2;
+    }
+    try {
+      baseline = readResults(in);
+    } catch (const std::runtime_error& e) {
+      std::cerr << baseline_path << ": " << e.what() << '\n';
+      return 2;
+    }
+  }
+
+  char header[128];
+  snprintf(header, sizeof(header), "%-22s %10s %7s %13s\n", "benchmark", "median", "noise",
+           "peak RSS");
+  std::cout << header;
+  std::vector<Result> results;
+  bool regressed = false;
+  for (size_t size : sizes) {
+    BenchmarkLibrary library = writeLibrary(size);
+    for (const BenchmarkStep& step : benchmarkSteps()) {
+      Result result = runBenchmark(step, library, min_repetitions);
+      printResult(result);
+      auto it = baseline.find(result.name);
+      if (update_baseline) {
+        std::cout << '\n';
+      } else if (it == baseline.end()) {
+        std::cout << "  (not in baseline)\n";
+      } else {
+        for (int run = 0;; run++) {
+          std::string regressions = compare(result, it->second, threshold);
+          if (regressions.empty()) {
+            std::cout << '\n';
+            break;
+          }
+          if (run == kConfirmationRuns) {
+            std::cout << "  REGRESSION (" << regressions << ")\n";
+            regressed = true;
+            break;
+          }
+          std::cout << "  (rerunning)\n";
+          result = runBenchmark(step, library, min_repetitions);
+          printResult(result);
+        }
+      }
+      results.push_back(result);
+    }
+    std::filesystem::remove_all(library.root);
+  }
+
+  for (const std::string& path : {output_path, update_baseline ? baseline_path : std::string()}) {
+    if (path.empty()) {
+      continue;
+    }
+    std::ofstream out(resolvePath(path));
+    writeResults(out, results);
+    if (!out) {
+      std::cerr << "Could not write " << path << '\n';
+      return 2;
+    }
+  }
+  if (update_baseline) {
+    std::cout << "Wrote baseline to " << baseline_path << '\n';
+    return 0;
+  }
+  if (regressed) {
+    std::cout << "Some benchmarks regressed\n";
+    return 1;
+  }
+  return 0;
+}
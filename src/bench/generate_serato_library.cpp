@@ -0,0 +1,58 @@
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "synthetic_library.h"
+
+// Usage:
+//   generate_serato_library [--tracks=N] [--path_length=N] [--non_ascii_ratio=X] [--crates=N]
+//                           [--nesting_depth=N] [--membership_density=X] [--seed=N] path
+// Writes a synthetic Serato library into path/_Serato_. See SyntheticLibraryOptions for what the
+// flags mean.
+
+int main(int argc, char** argv) {
+  SyntheticLibraryOptions options;
+  std::string out_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string flag = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    if (flag == "--tracks") {
+      options.tracks = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--path_length") {
+      options.path_length = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--non_ascii_ratio") {
+      options.non_ascii_ratio = std::strtod(value, nullptr);
+    } else if (flag == "--crates") {
+      options.crates = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--nesting_depth") {
+      options.nesting_depth = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--membership_density") {
+      options.membership_density = std::strtod(value, nullptr);
+    } else if (flag == "--seed") {
+      options.seed = std::strtoul(value, nullptr, 10);
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "Unknown flag " << arg << '\n';
+      return 1;
+    } else {
+      out_path = arg;
+    }
+  }
+  if (out_path.empty()) {
+    std::cerr << "Usage: generate_serato_library [flags] path\n";
+    return 1;
+  }
+
+  SyntheticLibraryStats stats;
+  try {
+    stats = writeSyntheticLibrary(out_path, options);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  std::cout << "Wrote " << options.tracks << " tracks (" << stats.database_bytes
+            << " bytes) and " << options.crates << " crates with " << stats.crate_tracks
+            << " entries (" << stats.crate_bytes << " bytes)\n";
+}
@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include "benchmark_steps.h"
+
+// Benchmarks for the steps of readLibrary (see benchmark_steps.h), run against synthetic libraries
+// of several sizes. Each benchmark's argument is the number of tracks in the library. Throughput
+// is reported both as bytes/s of input and as tracks/s (crate_entries/s for the crate steps).
+
+namespace {
+
+// Returns a library with the given number of tracks, writing it on first use.
+const BenchmarkLibrary& library(size_t tracks) {
+  static std::map<size_t, BenchmarkLibrary> libraries;
+  auto it = libraries.find(tracks);
+  if (it != libraries.end()) {
+    return it->second;
+  }
+
+  const char* tmpdir = std::getenv("TEST_TMPDIR");
+  std::filesystem::path root = std::filesystem::path(tmpdir ? tmpdir : "/tmp")
+      / ("seratocrates_benchmark_" + std::to_string(tracks));
+  return libraries[tracks] = writeBenchmarkLibrary(root.native(), tracks);
+}
+
+void runStep(benchmark::State& state, const BenchmarkStep& step) {
+  const BenchmarkLibrary& l = library(state.range(0));
+  StepRun run = step.setup(l);
+  for (auto _ : state) {
+    if (run.prepare) {
+      state.PauseTiming();
+      run.prepare();
+      state.ResumeTiming();
+    }
+    run.run();
+  }
+  if (size_t bytes = step.bytes(l)) {
+    state.SetBytesProcessed(state.iterations() * bytes);
+  }
+  state.counters[std::string(step.items_name) + "/s"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * step.items(l)), benchmark::Counter::kIsRate);
+}
+
+bool registerSteps() {
+  for (const BenchmarkStep& step : benchmarkSteps()) {
+    benchmark::RegisterBenchmark(step.name, runStep, step)
+        ->Arg(1000)->Arg(50000)->Unit(benchmark::kMillisecond);
+  }
+  return true;
+}
+
+const bool registered = registerSteps();
+
+}  // namespace
@@ -0,0 +1,170 @@
+#include <cmath>
+#include <codecvt>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <locale>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "synthetic_library.h"
+
+namespace {
+
+// Characters used to pad out paths. Non-ASCII paths also draw from kNonAsciiPieces, which
+// include both precomposed and combining forms, and characters outside the BMP.
+const char kAsciiChars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -_";
+const char* const kNonAsciiPieces[] = {
+  "é", "é", "ü", "ñ", "ß", "Å", "ø", "ł",
+  "Ж", "Ω", "日本", "한", "\U0001f3b5",
+};
+
+const char* const kKeys[] = {
+  "C", "Cm", "C#", "C#m", "D", "Dm", "Eb", "Ebm", "E", "Em", "F", "Fm",
+  "F#", "F#m", "G", "Gm", "Ab", "Abm", "A", "Am", "Bb", "Bbm", "B", "Bm",
+};
+
+// Serializes records in the on-disk format read by read_disk_files.h.
+class RecordWriter {
+public:
+  void string(const char* tag, const std::string& value) {
+    std::u16string utf16 =
+        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>{}.from_bytes(value);
+    header(tag, utf16.size() * 2);
+    for (char16_t c : utf16) {
+      out_.push_back(static_cast<char>(c >> 8));
+      out_.push_back(static_cast<char>(c & 0xFF));
+    }
+  }
+
+  void uint32(const char* tag, uint32_t value) {
+    header(tag, 4);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out_.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+  }
+
+  void object(const char* tag, const RecordWriter& fields) {
+    header(tag, fields.out_.size());
+    out_ += fields.out_;
+  }
+
+  const std::string& bytes() const {
+    return out_;
+  }
+
+private:
+  void header(const char* tag, size_t size) {
+    out_.append(tag, 4);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out_.push_back(static_cast<char>((size >> shift) & 0xFF));
+    }
+  }
+
+  std::string out_;
+};
+
+size_t writeFile(const std::filesystem::path& path, const std::string& bytes) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  if (!out) {
+    throw std::runtime_error("Could not write " + path.native());
+  }
+  return bytes.size();
+}
+
+std::string makePath(size_t index, const SyntheticLibraryOptions& options, std::mt19937* rng) {
+  std::string path = "Music/Artist " + std::to_string(index % 997) + "/";
+  bool non_ascii = std::bernoulli_distribution(options.non_ascii_ratio)(*rng);
+  std::uniform_int_distribution<size_t> ascii_char(0, sizeof(kAsciiChars) - 2);
+  std::uniform_int_distribution<size_t> non_ascii_piece(0, std::size(kNonAsciiPieces) - 1);
+  std::string suffix = " " + std::to_string(index) + ".mp3";
+  while (path.size() + suffix.size() < options.path_length) {
+    if (non_ascii && ascii_char(*rng) < 8) {
+      path += kNonAsciiPieces[non_ascii_piece(*rng)];
+    } else {
+      path += kAsciiChars[ascii_char(*rng)];
+    }
+  }
+  return path + suffix;
+}
+
+}  // namespace
+
+
+SyntheticLibraryStats writeSyntheticLibrary(
+    const std::string& root, const SyntheticLibraryOptions& options) {
+  if (!(options.membership_density > 0 && options.membership_density <= 1)) {
+    throw std::invalid_argument("membership_density must be greater than 0 and at most 1");
+  }
+  SyntheticLibraryStats stats;
+  std::mt19937 rng(options.seed);
+  std::filesystem::path serato_dir = std::filesystem::path(root) / "_Serato_";
+  std::filesystem::path crates_dir = serato_dir / "Subcrates";
+  std::filesystem::create_directories(crates_dir);
+
+  std::vector<std::string> paths;
+  paths.reserve(options.tracks);
+  RecordWriter database;
+  database.string("vrsn", "2.0/Serato Scratch LIVE Database");
+  for (size_t i = 0; i < options.tracks; i++) {
+    paths.push_back(makePath(i, options, &rng));
+    RecordWriter track;
+    track.string("ttyp", "mp3");
+    track.string("pfil", paths.back());
+    track.string("tsng", "Track " + std::to_string(i));
+    track.string("tart", "Artist " + std::to_string(i % 997));
+    track.string("talb", "Album " + std::to_string(i % 4999));
+    track.string("tcom", i % 3 == 0 ? "Bought on vinyl" : "");
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f",
+             std::uniform_int_distribution<int>(7000, 17500)(rng) / 100.0);
+    track.string("tbpm", text);
+    track.string("tkey", kKeys[std::uniform_int_distribution<size_t>(0, std::size(kKeys) - 1)(rng)]);
+    int length = std::uniform_int_distribution<int>(90, 600)(rng);
+    snprintf(text, sizeof(text), "%02d:%02d.%02d", length / 60, length % 60,
+             static_cast<int>(i % 100));
+    track.string("tlen", text);
+    // Spread over about three years, ending at 2024-01-01.
+    track.uint32("uadd", 1704067200 - std::uniform_int_distribution<uint32_t>(0, 94608000)(rng));
+    database.object("otrk", track);
+  }
+  stats.database_bytes = writeFile(serato_dir / "database V2", database.bytes());
+
+  // Crate i's parent, if any, is a random earlier crate that isn't already too deep.
+  std::vector<std::string> crate_names;
+  std::vector<size_t> crate_depths;
+  for (size_t i = 0; i < options.crates; i++) {
+    std::string name = "Crate " + std::to_string(i);
+    size_t depth = 0;
+    if (i > 0 && options.nesting_depth > 0 && std::bernoulli_distribution(0.5)(rng)) {
+      size_t parent = std::uniform_int_distribution<size_t>(0, i - 1)(rng);
+      if (crate_depths[parent] < options.nesting_depth) {
+        name = crate_names[parent] + "%%" + name;
+        depth = crate_depths[parent] + 1;
+      }
+    }
+    crate_names.push_back(name);
+    crate_depths.push_back(depth);
+
+    RecordWriter crate;
+    crate.string("vrsn", "1.0/Serato ScratchLive Crate");
+    if (!paths.empty()) {
+      // Skip ahead by geometrically distributed gaps rather than flipping a coin per track. The
+      // distribution needs p < 1; just below 1 still puts (almost) every track in the crate.
+      std::geometric_distribution<size_t> gap(
+          std::min(options.membership_density, std::nextafter(1.0, 0.0)));
+      for (size_t t = gap(rng); t < paths.size(); t += 1 + gap(rng)) {
+        RecordWriter crate_track;
+        crate_track.string("ptrk", paths[t]);
+        crate.object("otrk", crate_track);
+        stats.crate_tracks++;
+      }
+    }
+    stats.crate_bytes += writeFile(crates_dir / (name + ".crate"), crate.bytes());
+  }
+
+  return stats;
+}
@@ -0,0 +1,35 @@
+// This file contains writeSyntheticLibrary, which writes a made-up Serato library to disk for
+// benchmarks.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct SyntheticLibraryOptions {
+  size_t tracks = 1000;
+  // Approximate length (in characters) of each track path.
+  size_t path_length = 60;
+  // Fraction of tracks whose paths contain non-ASCII characters.
+  double non_ascii_ratio = 0.1;
+  size_t crates = 50;
+  // Maximum number of ancestors a crate can have. 0 means no subcrates.
+  size_t nesting_depth = 2;
+  // Probability that any given track is in any given crate. Must be in (0, 1].
+  double membership_density = 0.05;
+  uint32_t seed = 1;
+};
+
+// Describes what writeSyntheticLibrary wrote.
+struct SyntheticLibraryStats {
+  size_t database_bytes = 0;
+  size_t crate_bytes = 0;
+  // Total number of track entries across all crates.
+  size_t crate_tracks = 0;
+};
+
+// Writes root/_Serato_/database V2 and root/_Serato_/Subcrates/*.crate. The output only depends
+// on options, so benchmarks that use the same options see the same library. Throws
+// std::invalid_argument if options are out of range, or std::runtime_error if a file can't be
+// written.
+SyntheticLibraryStats writeSyntheticLibrary(
+    const std::string& root, const SyntheticLibraryOptions& options);
@@ -0,0 +1,177 @@
+#include <filesystem>
+
+#include "batch_read.h"
+#include "crate_catalog.h"
+#include "library_reader.h"
+
+CrateCatalog::CrateCatalog(const std::string& path, const ReadOptions& options)
+    : path_(path), options_(options) {}
+
+CrateCatalog::~CrateCatalog() = default;
+
+const std::vector<CrateName>& CrateCatalog::listCrates() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (listed_) {
+    return crate_names_;
+  }
+
+  LoadStats stats;
+  ReadOptions options = localOptions(&stats);
+  std::vector<std::string> paths;
+  {
+    PhaseTimer timer(options, &LoadStats::list_crates_seconds);
+    paths = listCrateFiles((std::filesystem::path(path_) / "_Serato_" / "Subcrates").native());
+  }
+
+  {
+    PhaseTimer timer(options, &LoadStats::nest_seconds);
+    // listCrateFiles returns each crate before its subcrates, so a crate's parent is always
+    // placed before the crate itself. Placed crates are remembered by their indexes at each level
+    // of the tree, since pointers into the vectors would be invalidated as they grow.
+    std::map<std::vector<std::string>, std::vector<size_t>> pieces_to_index_path;
+    for (const std::string& path : paths) {
+      std::string full_name = std::filesystem::path(path).stem().native();
+      std::vector<std::string> pieces = crateNamePieces(full_name);
+      crate_paths_[full_name] = path;
+
+      std::vector<CrateName>* siblings = &crate_names_;
+      std::vector<size_t> index_path;
+      if (pieces.size() > 1) {
+        auto parent = pieces_to_index_path.find(
+            std::vector<std::string>(pieces.begin(), pieces.end() - 1));
+        if (parent == pieces_to_index_path.end()) {
+          // Crate's parent was not present. Skip it, as nestCrates does.
+          continue;
+        }
+        index_path = parent->second;
+        for (size_t index : index_path) {
+          siblings = &(*siblings)[index].subcrates;
+        }
+      }
+      index_path.push_back(siblings->size());
+      siblings->push_back(CrateName{pieces.back(), full_name, {}});
+      pieces_to_index_path.emplace(std::move(pieces), std::move(index_path));
+    }
+  }
+  mergeStats(stats);
+
+  listed_ = true;
+  return crate_names_;
+}
+
+const std::vector<std::shared_ptr<Track>>& CrateCatalog::tracks() {
+  loadDatabase();
+  return database_->tracks;
+}
+
+std::shared_ptr<const Crate> CrateCatalog::readCrate(const std::string& full_name) {
+  listCrates();
+
+  // The first thread to ask for a crate reads it; the others wait for its result.
+  std::promise<std::shared_ptr<const Crate>> promise;
+  std::string path;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto cached = crates_.find(full_name);
+    if (cached != crates_.end()) {
+      std::shared_future<std::shared_ptr<const Crate>> crate = cached->second;
+      lock.unlock();
+      return crate.get();
+    }
+    auto found = crate_paths_.find(full_name);
+    if (found == crate_paths_.end()) {
+      throw ReadException("No crate named " + full_name);
+    }
+    path = found->second;
+    crates_.emplace(full_name, promise.get_future().share());
+  }
+
+  try {
+    loadDatabase();
+    LoadStats stats;
+    ReadOptions options = localOptions(&stats);
+    std::string data;
+    FileVersion version;
+    {
+      PhaseTimer timer(options, &LoadStats::parse_crates_seconds);
+      data = readFile(path, options, &version);
+    }
+    if (options.progress) {
+      options.progress->bytes_total += data.size();
+    }
+
+    std::shared_ptr<Crate> crate;
+    {
+      std::lock_guard<std::mutex> lock(reader_mutex_);
+      if (options_.stats) {
+        addStats(options_.stats, stats);
+      }
+      crate = std::make_shared<Crate>(reader_->read(path, data, &version));
+    }
+    crate->name = crateNamePieces(full_name).back();
+    promise.set_value(crate);
+    return crate;
+  } catch (...) {
+    // Forget the failure, so that a later call tries again.
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      crates_.erase(full_name);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+}
+
+void CrateCatalog::loadDatabase() {
+  std::promise<void> promise;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (database_loaded_.valid()) {
+      std::shared_future<void> loaded = database_loaded_;
+      lock.unlock();
+      loaded.get();
+      return;
+    }
+    database_loaded_ = promise.get_future().share();
+  }
+
+  try {
+    LoadStats stats;
+    ReadOptions options = localOptions(&stats);
+    {
+      PhaseTimer timer(options, &LoadStats::database_seconds);
+      std::unique_ptr<DatabaseFile> database_file = readFromPath<DatabaseFile>(
+          (std::filesystem::path(path_) / "_Serato_" / "database V2").native(), options);
+      database_ = std::make_unique<Library>(*database_file);
+    }
+    reader_ = std::make_unique<CrateReader>(database_->tracks, options_);
+    mergeStats(stats);
+    promise.set_value();
+  } catch (...) {
+    {
+      // Reset before clearing database_loaded_: once it's cleared, another thread may start a
+      // new load that assigns these.
+      std::lock_guard<std::mutex> lock(mutex_);
+      database_.reset();
+      reader_.reset();
+      database_loaded_ = std::shared_future<void>();
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+}
+
+ReadOptions CrateCatalog::localOptions(LoadStats* stats) const {
+  ReadOptions ret = options_;
+  if (options_.stats) {
+    ret.stats = stats;
+  }
+  return ret;
+}
+
+void CrateCatalog::mergeStats(const LoadStats& stats) {
+  if (options_.stats) {
+    std::lock_guard<std::mutex> lock(reader_mutex_);
+    addStats(options_.stats, stats);
+  }
+}
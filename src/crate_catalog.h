@@ -0,0 +1,80 @@
+// This file contains CrateCatalog, for listing a library's crates and reading them one at a time.
+#pragma once
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+class CrateReader;
+
+// A crate's place in the crate tree, without its tracks.
+struct CrateName {
+  // The crate's own name, e.g. "Child".
+  std::string name;
+  // Serato's name for the crate, e.g. "Parent%%Child". Pass this to CrateCatalog::readCrate.
+  std::string full_name;
+  std::vector<CrateName> subcrates;
+};
+
+// CrateCatalog is a lazy alternative to readLibrary for callers that only need some of the
+// crates, e.g. a UI that shows one crate at a time. Listing the crates only lists the Subcrates
+// directory, and each crate is parsed the first time it's asked for.
+//
+// All methods are safe to call from several threads at once. Reading one crate doesn't hold up
+// calls for crates that are already cached, or the reading of other crates' files.
+class CrateCatalog {
+public:
+  // path is as for readLibrary. Nothing is read until one of the methods below is called.
+  explicit CrateCatalog(const std::string& path, const ReadOptions& options = ReadOptions());
+  ~CrateCatalog();
+
+  // Returns the tree of crate names, built from the names of the .crate files. As in readLibrary,
+  // crates are sorted by name, and subcrates whose parent crate doesn't exist are left out. The
+  // listing is read on the first call and then kept.
+  const std::vector<CrateName>& listCrates();
+
+  // Returns the tracks in the database, reading it on the first call.
+  const std::vector<std::shared_ptr<Track>>& tracks();
+
+  // Reads the crate with the given full name (see CrateName::full_name) and resolves its tracks
+  // against tracks(). The result is cached, so later calls for the same crate are free. The
+  // returned crate's name is its own name, and its subcrates are left empty; read them
+  // individually. Throws ReadException if there's no such crate.
+  std::shared_ptr<const Crate> readCrate(const std::string& full_name);
+
+private:
+  // Reads the database unless it has been read already. If another thread is reading it, waits
+  // for that thread instead.
+  void loadDatabase();
+
+  // Returns options_, but collecting stats into *stats. Loads record their stats separately and
+  // add them to options_.stats with mergeStats, so that they can run concurrently.
+  ReadOptions localOptions(LoadStats* stats) const;
+  void mergeStats(const LoadStats& stats);
+
+  std::string path_;
+  ReadOptions options_;
+  // Guards everything below except database_ and reader_. Never held during file reads, except
+  // while listing the crates. Must not be taken while holding reader_mutex_.
+  std::mutex mutex_;
+
+  bool listed_ = false;
+  std::vector<CrateName> crate_names_;
+  // Full crate name to .crate file path.
+  std::map<std::string, std::string> crate_paths_;
+
+  // Ready once database_ and reader_ have been set; invalid until a thread starts reading them.
+  std::shared_future<void> database_loaded_;
+  std::unique_ptr<Library> database_;
+  std::unique_ptr<CrateReader> reader_;
+  // Guards reader_ (whose PathResolver isn't thread-safe) and *options_.stats.
+  std::mutex reader_mutex_;
+
+  // Crates that have been read, or are being read by some thread.
+  std::map<std::string, std::shared_future<std::shared_ptr<const Crate>>> crates_;
+};
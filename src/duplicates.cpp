@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string_view>
+#include <unordered_map>
+
+#include "duplicates.h"
+#include "library_reader.h"
+#include "parallel.h"
+#include "path_normalization.h"
+#include "track_index.h"
+#include "track_indexes.h"
+
+namespace {
+
+// File checks are I/O-bound, so use more threads than there are cores.
+const size_t kFileThreads = 16;
+
+// Hashes up to three samples of the file (start, middle and end) along with its size. Returns 0
+// if the file can't be read.
+uint64_t sampleHash(const std::string& path, uint64_t size, size_t sample_bytes) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  std::string buffer;
+  std::string sample(std::min<uint64_t>(sample_bytes, size), '\0');
+  uint64_t offsets[] = {0, size / 2 - std::min<uint64_t>(size / 2, sample.size() / 2),
+                        size - sample.size()};
+  for (uint64_t offset : offsets) {
+    ssize_t n = pread(fd, sample.data(), sample.size(), offset);
+    if (n < 0) {
+      close(fd);
+      return 0;
+    }
+    buffer.append(sample.data(), n);
+  }
+  close(fd);
+  buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  // Reserve 0 for "unreadable".
+  return std::max<uint64_t>(1, hashPath(buffer));
+}
+
+void findMetadataDuplicates(const Library& library, const DuplicateOptions& options,
+                            std::vector<DuplicateGroup>* groups) {
+  // Bucket by normalized artist and title.
+  std::vector<std::string> keys(library.tracks.size());
+  parallelFor(library.tracks.size(), [&](size_t i) {
+    const Track& track = *library.tracks[i];
+    if (!track.artist.empty() && !track.title.empty()) {
+      keys[i] = normalizePathKey(track.artist) + '\x1f' + normalizePathKey(track.title);
+    }
+  });
+  std::unordered_map<std::string_view, std::vector<size_t>> buckets;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!keys[i].empty()) {
+      buckets[keys[i]].push_back(i);
+    }
+  }
+
+  // Within a bucket, sort by duration and split wherever consecutive tracks are further apart
+  // than the tolerance. Tracks without a duration go into a group of their own.
+  for (auto& bucket : buckets) {
+    std::vector<size_t>& tracks = bucket.second;
+    if (tracks.size() < 2) {
+      continue;
+    }
+    std::vector<std::pair<double, size_t>> by_duration;
+    for (size_t pos : tracks) {
+      double duration = parseDuration(library.tracks[pos]->length);
+      by_duration.emplace_back(std::isnan(duration) ? INFINITY : duration, pos);
+    }
+    std::sort(by_duration.begin(), by_duration.end());
+
+    DuplicateGroup group{DuplicateGroup::Reason::kMetadata, {}, {}};
+    for (size_t i = 0; i <= by_duration.size(); i++) {
+      bool split = i == by_duration.size() || (i > 0 && !(
+          by_duration[i].first - by_duration[i - 1].first <= options.duration_tolerance
+          || (std::isinf(by_duration[i].first) && std::isinf(by_duration[i - 1].first))));
+      if (split) {
+        if (group.tracks.size() >= 2) {
+          groups->push_back(group);
+        }
+        group.tracks.clear();
+      }
+      if (i < by_duration.size()) {
+        group.tracks.push_back(by_duration[i].second);
+      }
+    }
+  }
+}
+
+void findContentDuplicates(const Library& library, const DuplicateOptions& options,
+                           std::vector<DuplicateGroup>* groups) {
+  size_t count = library.tracks.size();
+  std::vector<std::string> paths(count);
+  std::vector<uint64_t> sizes(count, 0);
+  parallelFor(count, [&](size_t i) {
+    paths[i] = (std::filesystem::path(options.root) / library.tracks[i]->path).native();
+    struct stat st;
+    if (stat(paths[i].c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      sizes[i] = st.st_size;
+    }
+  }, kFileThreads);
+
+  // Only files that share a size with another file need their contents hashed.
+  std::unordered_map<uint64_t, std::vector<size_t>> by_size;
+  for (size_t i = 0; i < count; i++) {
+    if (sizes[i] > 0) {
+      by_size[sizes[i]].push_back(i);
+    }
+  }
+  std::vector<size_t> to_hash;
+  for (const auto& bucket : by_size) {
+    if (bucket.second.size() >= 2) {
+      to_hash.insert(to_hash.end(), bucket.second.begin(), bucket.second.end());
+    }
+  }
+  std::vector<uint64_t> hashes(count, 0);
+  parallelFor(to_hash.size(), [&](size_t i) {
+    size_t pos = to_hash[i];
+    hashes[pos] = sampleHash(paths[pos], sizes[pos], options.sample_bytes);
+  }, kFileThreads);
+
+  std::unordered_map<uint64_t, std::vector<size_t>> by_hash;
+  for (size_t pos : to_hash) {
+    if (hashes[pos] != 0) {
+      by_hash[hashes[pos]].push_back(pos);
+    }
+  }
+  for (auto& bucket : by_hash) {
+    if (bucket.second.size() >= 2) {
+      groups->push_back(DuplicateGroup{DuplicateGroup::Reason::kContent, bucket.second, {}});
+    }
+  }
+}
+
+}  // namespace
+
+
+std::vector<DuplicateGroup> findDuplicates(
+    const Library& library, const DuplicateOptions& options) {
+  std::vector<DuplicateGroup> ret;
+  if (options.compare_metadata) {
+    findMetadataDuplicates(library, options, &ret);
+  }
+  if (options.compare_content) {
+    findContentDuplicates(library, options, &ret);
+  }
+
+  std::unordered_map<const Track*, std::vector<std::string>> track_crates =
+      crateNamesByTrack(library);
+  for (DuplicateGroup& group : ret) {
+    std::sort(group.tracks.begin(), group.tracks.end());
+    for (size_t pos : group.tracks) {
+      auto it = track_crates.find(library.tracks[pos].get());
+      group.crates.push_back(
+          it == track_crates.end() ? std::vector<std::string>() : it->second);
+    }
+  }
+  // Report groups in a stable order.
+  std::sort(ret.begin(), ret.end(), [](const DuplicateGroup& a, const DuplicateGroup& b) {
+    return a.tracks < b.tracks;
+  });
+  return ret;
+}
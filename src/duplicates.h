@@ -0,0 +1,44 @@
+// This file contains findDuplicates, which finds tracks in a Library that are probably the same
+// song.
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+struct DuplicateOptions {
+  // Group tracks whose artist and title match (ignoring case and Unicode normalization form) and
+  // whose durations are within duration_tolerance seconds of each other. This catches re-encodes.
+  bool compare_metadata = true;
+  double duration_tolerance = 2.0;
+
+  // Group tracks whose files have the same size and the same hash of a few samples of their
+  // contents. This catches the same file stored under several paths.
+  bool compare_content = true;
+  // Size of each of the (up to three) samples hashed per file.
+  size_t sample_bytes = 64 * 1024;
+  // Serato stores paths relative to the root of the volume holding the library, so files are
+  // looked up relative to this.
+  std::string root = "/";
+};
+
+struct DuplicateGroup {
+  enum class Reason {
+    kMetadata,
+    kContent,
+  };
+
+  Reason reason;
+  // Positions in Library::tracks, in ascending order.
+  std::vector<size_t> tracks;
+  // crates[i] lists the crates that contain tracks[i], using Serato's names for them
+  // ("Parent%%Child").
+  std::vector<std::vector<std::string>> crates;
+};
+
+// Finds groups of two or more tracks that look like duplicates. Candidates are bucketed by hash
+// (of normalized metadata, or of file size and then sampled contents), so only tracks that share
+// a bucket are ever compared. File checks run on a pool of threads.
+std::vector<DuplicateGroup> findDuplicates(
+    const Library& library, const DuplicateOptions& options = DuplicateOptions());
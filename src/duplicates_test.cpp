@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#include "duplicates.h"
+
+namespace {
+
+typedef std::vector<size_t> Positions;
+
+std::shared_ptr<Track> makeTrack(const std::string& artist, const std::string& title,
+                                 const std::string& length, const std::string& path = "") {
+  auto track = std::make_shared<Track>();
+  track->path = path.empty() ? artist + " - " + title + " " + length + ".mp3" : path;
+  track->artist = artist;
+  track->title = title;
+  track->length = length;
+  return track;
+}
+
+std::vector<Positions> groupTracks(const std::vector<DuplicateGroup>& groups) {
+  std::vector<Positions> ret;
+  for (const DuplicateGroup& group : groups) {
+    ret.push_back(group.tracks);
+  }
+  return ret;
+}
+
+DuplicateOptions metadataOnly() {
+  DuplicateOptions options;
+  options.compare_content = false;
+  return options;
+}
+
+}  // namespace
+
+TEST(DuplicatesTest, MatchesMetadataAcrossCaseAndNormalizationForms) {
+  Library library;
+  // "Café" in NFC and in NFD, and "Beyoncé" differing in case too.
+  library.tracks = {
+      makeTrack("Caf\xc3\xa9", "Song", "03:00.00"),
+      makeTrack("Other", "Song", "03:00.00"),
+      makeTrack("Cafe\xcc\x81", "SONG", "03:01.00"),
+      makeTrack("BEYONC\xc3\x89", "Halo", "04:00.00"),
+      makeTrack("beyonce\xcc\x81", "halo", "04:00.00"),
+  };
+  std::vector<DuplicateGroup> groups = findDuplicates(library, metadataOnly());
+  EXPECT_EQ(groupTracks(groups), std::vector<Positions>({{0, 2}, {3, 4}}));
+  for (const DuplicateGroup& group : groups) {
+    EXPECT_EQ(group.reason, DuplicateGroup::Reason::kMetadata);
+  }
+}
+
+TEST(DuplicatesTest, SplitsGroupsByDuration) {
+  Library library;
+  library.tracks = {
+      makeTrack("A", "T", "03:00.00"),
+      makeTrack("A", "T", "03:01.50"),
+      // 2.5 seconds after the previous one, so too far with the default tolerance.
+      makeTrack("A", "T", "03:04.00"),
+      makeTrack("A", "T", "03:05.00"),
+      // Tracks without a duration are grouped with each other but not with the rest.
+      makeTrack("A", "T", ""),
+      makeTrack("A", "T", "bad"),
+  };
+  EXPECT_EQ(groupTracks(findDuplicates(library, metadataOnly())),
+            std::vector<Positions>({{0, 1}, {2, 3}, {4, 5}}));
+
+  DuplicateOptions options = metadataOnly();
+  options.duration_tolerance = 3;
+  EXPECT_EQ(groupTracks(findDuplicates(library, options)),
+            std::vector<Positions>({{0, 1, 2, 3}, {4, 5}}));
+}
+
+TEST(DuplicatesTest, IgnoresTracksWithoutArtistOrTitle) {
+  Library library;
+  library.tracks = {
+      makeTrack("", "T", "03:00.00", "1.mp3"),
+      makeTrack("", "T", "03:00.00", "2.mp3"),
+      makeTrack("A", "", "03:00.00", "3.mp3"),
+      makeTrack("A", "", "03:00.00", "4.mp3"),
+  };
+  EXPECT_TRUE(findDuplicates(library, metadataOnly()).empty());
+}
+
+TEST(DuplicatesTest, ListsCratesOfEachTrack) {
+  Library library;
+  library.tracks = {makeTrack("A", "T", "03:00.00"), makeTrack("a", "t", "03:00.00", "copy.mp3")};
+  Crate house{"House", "", {library.tracks[0]}, {}};
+  house.subcrates.push_back(Crate{"Deep", "", {library.tracks[0]}, {}});
+  library.crates = {house};
+
+  std::vector<DuplicateGroup> groups = findDuplicates(library, metadataOnly());
+  ASSERT_EQ(groups.size(), 1u);
+  ASSERT_EQ(groups[0].crates.size(), 2u);
+  EXPECT_EQ(groups[0].crates[0], std::vector<std::string>({"House", "House%%Deep"}));
+  EXPECT_TRUE(groups[0].crates[1].empty());
+}
+
+class DuplicateContentTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    const char* tmpdir = std::getenv("TEST_TMPDIR");
+    root_ = std::filesystem::path(tmpdir ? tmpdir : "/tmp") / "duplicates_test";
+    std::filesystem::remove_all(root_);
+    std::filesystem::create_directories(root_ / "Music");
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(root_);
+  }
+
+  // Adds a track whose file (relative to root_) holds contents, or doesn't exist if contents is
+  // empty. Tracks get distinct metadata so that only content can match them.
+  void addTrack(const std::string& path, const std::string& contents) {
+    if (!contents.empty()) {
+      std::ofstream(root_ / path, std::ios::binary) << contents;
+    }
+    library_.tracks.push_back(
+        makeTrack("Artist", std::to_string(library_.tracks.size()), "03:00.00", path));
+  }
+
+  std::vector<DuplicateGroup> find(size_t sample_bytes) {
+    DuplicateOptions options;
+    options.compare_metadata = false;
+    options.sample_bytes = sample_bytes;
+    options.root = root_.native();
+    return findDuplicates(library_, options);
+  }
+
+  std::filesystem::path root_;
+  Library library_;
+};
+
+TEST_F(DuplicateContentTest, GroupsFilesWithTheSameContents) {
+  std::string contents(100000, 'x');
+  std::string other = contents;
+  other[50000] = 'y';
+  addTrack("Music/a.mp3", contents);
+  addTrack("Music/b.mp3", other);
+  addTrack("Music/c.mp3", contents);
+  addTrack("Music/missing.mp3", "");
+  addTrack("Music/missing2.mp3", "");
+  addTrack("Music/short.mp3", "x");
+
+  std::vector<DuplicateGroup> groups = find(4096);
+  EXPECT_EQ(groupTracks(groups), std::vector<Positions>({{0, 2}}));
+  ASSERT_EQ(groups.size(), 1u);
+  EXPECT_EQ(groups[0].reason, DuplicateGroup::Reason::kContent);
+}
+
+// Only samples are hashed, so files that differ outside them are reported as duplicates.
+TEST_F(DuplicateContentTest, OnlyHashesSamples) {
+  std::string contents(100000, 'x');
+  std::string other = contents;
+  other[25000] = 'y';
+  addTrack("Music/a.mp3", contents);
+  addTrack("Music/b.mp3", other);
+  EXPECT_EQ(groupTracks(find(4096)), std::vector<Positions>({{0, 1}}));
+  EXPECT_TRUE(find(100000).empty());
+}
+
+TEST_F(DuplicateContentTest, SmallFilesAreHashedWhole) {
+  addTrack("Music/a.mp3", "abc");
+  addTrack("Music/b.mp3", "abd");
+  addTrack("Music/c.mp3", "abc");
+  EXPECT_EQ(groupTracks(find(4096)), std::vector<Positions>({{0, 2}}));
+}
@@ -0,0 +1,162 @@
+#include <unordered_map>
+
+#include "library_diff.h"
+#include "track_index.h"
+
+namespace {
+
+const uint32_t kNoTrack = UINT32_MAX;
+
+// A library's crates flattened into a list, with their tracks as positions in Library::tracks.
+struct FlatCrates {
+  std::vector<std::string> names;
+  std::vector<std::vector<uint32_t>> tracks;
+  std::unordered_map<std::string, size_t> index;
+};
+
+void addCrate(const Crate& crate, const std::string& prefix,
+              const std::unordered_map<const Track*, uint32_t>& positions, FlatCrates* crates) {
+  std::string name = prefix.empty() ? crate.name : prefix + "%%" + crate.name;
+  auto inserted = crates->index.emplace(name, crates->names.size());
+  if (inserted.second) {
+    crates->names.push_back(name);
+    crates->tracks.emplace_back();
+  }
+  std::vector<uint32_t>& members = crates->tracks[inserted.first->second];
+  for (const std::shared_ptr<Track>& track : crate.tracks) {
+    auto it = positions.find(track.get());
+    if (it != positions.end()) {
+      members.push_back(it->second);
+    }
+  }
+  for (const Crate& subcrate : crate.subcrates) {
+    addCrate(subcrate, name, positions, crates);
+  }
+}
+
+FlatCrates flattenCrates(const Library& library) {
+  std::unordered_map<const Track*, uint32_t> positions;
+  positions.reserve(library.tracks.size());
+  for (uint32_t i = 0; i < library.tracks.size(); i++) {
+    positions.emplace(library.tracks[i].get(), i);
+  }
+  FlatCrates ret;
+  for (const Crate& crate : library.crates) {
+    addCrate(crate, "", positions, &ret);
+  }
+  return ret;
+}
+
+bool sameMetadata(const Track& a, const Track& b) {
+  return a.title == b.title && a.artist == b.artist && a.album == b.album &&
+         a.comment == b.comment && a.bpm == b.bpm && a.key == b.key && a.length == b.length &&
+         a.date_added == b.date_added;
+}
+
+// Set membership over a fixed range of ids, which can be cleared in O(1) by bumping the
+// generation. Lets each crate be compared in time linear in its own size.
+class Marks {
+public:
+  explicit Marks(size_t size) : marks_(size, 0) {}
+
+  void clear() {
+    generation_++;
+  }
+
+  void set(size_t id) {
+    marks_[id] = generation_;
+  }
+
+  bool test(size_t id) const {
+    return marks_[id] == generation_;
+  }
+
+private:
+  std::vector<uint32_t> marks_;
+  uint32_t generation_ = 1;
+};
+
+}  // namespace
+
+
+LibraryDiff diff(const Library& before, const Library& after) {
+  LibraryDiff ret;
+
+  // Match tracks by path. new_position[i] is the position in after of before's i'th track.
+  TrackIndex after_index(after.tracks);
+  std::vector<uint32_t> new_position(before.tracks.size(), kNoTrack);
+  std::vector<bool> matched(after.tracks.size());
+  for (size_t i = 0; i < before.tracks.size(); i++) {
+    size_t pos = after_index.find(before.tracks[i]->path);
+    if (pos == TrackIndex::kNotFound) {
+      ret.removed_tracks.push_back(i);
+      continue;
+    }
+    new_position[i] = pos;
+    matched[pos] = true;
+    if (!sameMetadata(*before.tracks[i], *after.tracks[pos])) {
+      ret.changed_tracks.emplace_back(i, pos);
+    }
+  }
+  for (size_t i = 0; i < after.tracks.size(); i++) {
+    if (!matched[i]) {
+      ret.added_tracks.push_back(i);
+    }
+  }
+
+  // Compare crate memberships in after's position space. Tracks that were removed get ids past
+  // the end of after.tracks so that they never match anything.
+  FlatCrates before_crates = flattenCrates(before);
+  FlatCrates after_crates = flattenCrates(after);
+  auto id = [&](uint32_t old_pos) -> size_t {
+    return new_position[old_pos] == kNoTrack ? after.tracks.size() + old_pos
+                                             : new_position[old_pos];
+  };
+  Marks marks(after.tracks.size() + before.tracks.size());
+  std::vector<bool> seen(after_crates.names.size());
+  for (size_t c = 0; c < before_crates.names.size(); c++) {
+    const std::vector<uint32_t>& old_tracks = before_crates.tracks[c];
+    CrateDiff crate_diff;
+    crate_diff.name = before_crates.names[c];
+    auto it = after_crates.index.find(crate_diff.name);
+    if (it == after_crates.index.end()) {
+      crate_diff.removed_tracks.assign(old_tracks.begin(), old_tracks.end());
+      ret.removed_crates.push_back(std::move(crate_diff));
+      continue;
+    }
+    seen[it->second] = true;
+    const std::vector<uint32_t>& new_tracks = after_crates.tracks[it->second];
+
+    marks.clear();
+    for (uint32_t pos : new_tracks) {
+      marks.set(pos);
+    }
+    for (uint32_t pos : old_tracks) {
+      if (!marks.test(id(pos))) {
+        crate_diff.removed_tracks.push_back(pos);
+      }
+    }
+    marks.clear();
+    for (uint32_t pos : old_tracks) {
+      marks.set(id(pos));
+    }
+    for (uint32_t pos : new_tracks) {
+      if (!marks.test(pos)) {
+        crate_diff.added_tracks.push_back(pos);
+      }
+    }
+    if (!crate_diff.added_tracks.empty() || !crate_diff.removed_tracks.empty()) {
+      ret.changed_crates.push_back(std::move(crate_diff));
+    }
+  }
+  for (size_t c = 0; c < after_crates.names.size(); c++) {
+    if (!seen[c]) {
+      CrateDiff crate_diff;
+      crate_diff.name = after_crates.names[c];
+      crate_diff.added_tracks.assign(after_crates.tracks[c].begin(),
+                                     after_crates.tracks[c].end());
+      ret.added_crates.push_back(std::move(crate_diff));
+    }
+  }
+  return ret;
+}
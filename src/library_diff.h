@@ -0,0 +1,43 @@
+// This file contains diff, which computes what changed between two snapshots of a library.
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+struct CrateDiff {
+  // Serato's name for the crate ("Parent%%Child").
+  std::string name;
+  // Positions in the new library's tracks of tracks added to the crate.
+  std::vector<size_t> added_tracks;
+  // Positions in the old library's tracks of tracks removed from the crate.
+  std::vector<size_t> removed_tracks;
+};
+
+struct LibraryDiff {
+  // Positions in the new library's tracks.
+  std::vector<size_t> added_tracks;
+  // Positions in the old library's tracks.
+  std::vector<size_t> removed_tracks;
+  // Pairs of (old position, new position) of tracks with the same path whose metadata differs.
+  std::vector<std::pair<size_t, size_t>> changed_tracks;
+
+  // Crates that only exist in the new library, with all of their tracks listed as added.
+  std::vector<CrateDiff> added_crates;
+  // Crates that only exist in the old library, with all of their tracks listed as removed.
+  std::vector<CrateDiff> removed_crates;
+  // Crates in both libraries whose tracks differ.
+  std::vector<CrateDiff> changed_crates;
+
+  bool empty() const {
+    return added_tracks.empty() && removed_tracks.empty() && changed_tracks.empty() &&
+           added_crates.empty() && removed_crates.empty() && changed_crates.empty();
+  }
+};
+
+// Returns the changes that turn before into after. Tracks are matched by path (using a hash
+// table) and crates by name, so this runs in time linear in the size of the two libraries.
+//
+// Lists are in the order the tracks and crates appear in their libraries.
+LibraryDiff diff(const Library& before, const Library& after);
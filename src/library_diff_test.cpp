@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include "library_diff.h"
+
+namespace {
+
+typedef std::vector<size_t> Positions;
+
+std::shared_ptr<Track> makeTrack(const std::string& path, const std::string& title = "") {
+  auto track = std::make_shared<Track>();
+  track->path = path;
+  track->title = title;
+  return track;
+}
+
+Library makeLibrary(const std::vector<std::string>& paths) {
+  Library library;
+  for (const std::string& path : paths) {
+    library.tracks.push_back(makeTrack(path));
+  }
+  return library;
+}
+
+Crate makeCrate(const std::string& name, const Library& library, const Positions& positions) {
+  Crate crate{name, "", {}, {}};
+  for (size_t pos : positions) {
+    crate.tracks.push_back(library.tracks[pos]);
+  }
+  return crate;
+}
+
+}  // namespace
+
+TEST(LibraryDiffTest, IdenticalLibrariesHaveNoChanges) {
+  Library before = makeLibrary({"a.mp3", "b.mp3"});
+  before.crates.push_back(makeCrate("House", before, {0, 1}));
+  Library after = makeLibrary({"a.mp3", "b.mp3"});
+  after.crates.push_back(makeCrate("House", after, {0, 1}));
+  EXPECT_TRUE(diff(before, after).empty());
+  EXPECT_TRUE(diff(Library(), Library()).empty());
+}
+
+TEST(LibraryDiffTest, MatchesTracksByPath) {
+  Library before = makeLibrary({"a.mp3", "b.mp3", "c.mp3"});
+  // Reordered, b removed, d added, c retitled.
+  Library after = makeLibrary({"d.mp3", "c.mp3", "a.mp3"});
+  after.tracks[1]->title = "New title";
+
+  LibraryDiff result = diff(before, after);
+  EXPECT_EQ(result.removed_tracks, Positions({1}));
+  EXPECT_EQ(result.added_tracks, Positions({0}));
+  ASSERT_EQ(result.changed_tracks.size(), 1u);
+  EXPECT_EQ(result.changed_tracks[0], std::make_pair(size_t(2), size_t(1)));
+}
+
+TEST(LibraryDiffTest, ComparesEveryMetadataField) {
+  for (int field = 0; field < 8; field++) {
+    Library before = makeLibrary({"a.mp3"});
+    Library after = makeLibrary({"a.mp3"});
+    Track& track = *after.tracks[0];
+    std::string* strings[] = {&track.title, &track.artist, &track.album, &track.comment,
+                              &track.bpm, &track.key, &track.length};
+    if (field < 7) {
+      *strings[field] = "x";
+    } else {
+      track.date_added = 1;
+    }
+    EXPECT_EQ(diff(before, after).changed_tracks.size(), 1u) << field;
+  }
+}
+
+// Paths are compared exactly, as Serato stores them.
+TEST(LibraryDiffTest, PathsAreCaseSensitive) {
+  LibraryDiff result = diff(makeLibrary({"a.mp3"}), makeLibrary({"A.mp3"}));
+  EXPECT_EQ(result.removed_tracks, Positions({0}));
+  EXPECT_EQ(result.added_tracks, Positions({0}));
+}
+
+// When a path is listed twice, the last copy is the track; earlier copies count as added.
+TEST(LibraryDiffTest, DuplicatePathsInTheNewLibrary) {
+  Library before = makeLibrary({"a.mp3", "b.mp3"});
+  Library after = makeLibrary({"a.mp3", "b.mp3", "a.mp3"});
+  after.tracks[2]->title = "Second copy";
+
+  LibraryDiff result = diff(before, after);
+  EXPECT_TRUE(result.removed_tracks.empty());
+  EXPECT_EQ(result.added_tracks, Positions({0}));
+  ASSERT_EQ(result.changed_tracks.size(), 1u);
+  EXPECT_EQ(result.changed_tracks[0], std::make_pair(size_t(0), size_t(2)));
+}
+
+TEST(LibraryDiffTest, DuplicatePathsInTheOldLibrary) {
+  Library before = makeLibrary({"a.mp3", "a.mp3", "b.mp3"});
+  before.crates.push_back(makeCrate("House", before, {0, 1}));
+  Library after = makeLibrary({"a.mp3", "b.mp3"});
+  after.crates.push_back(makeCrate("House", after, {0}));
+
+  // Both old copies match the new track, so nothing is removed from the library or the crate.
+  LibraryDiff result = diff(before, after);
+  EXPECT_TRUE(result.empty());
+}
+
+TEST(LibraryDiffTest, CrateMembership) {
+  Library before = makeLibrary({"a.mp3", "b.mp3", "c.mp3"});
+  before.crates.push_back(makeCrate("House", before, {0, 1}));
+  before.crates.push_back(makeCrate("Old", before, {2}));
+  Library after = makeLibrary({"c.mp3", "a.mp3", "d.mp3"});
+  // Keeps a (at a new position), loses b (removed from the library), gains c and d.
+  after.crates.push_back(makeCrate("House", after, {1, 0, 2}));
+  after.crates.push_back(makeCrate("New", after, {1}));
+
+  LibraryDiff result = diff(before, after);
+  ASSERT_EQ(result.changed_crates.size(), 1u);
+  EXPECT_EQ(result.changed_crates[0].name, "House");
+  EXPECT_EQ(result.changed_crates[0].removed_tracks, Positions({1}));
+  EXPECT_EQ(result.changed_crates[0].added_tracks, Positions({0, 2}));
+  ASSERT_EQ(result.removed_crates.size(), 1u);
+  EXPECT_EQ(result.removed_crates[0].name, "Old");
+  EXPECT_EQ(result.removed_crates[0].removed_tracks, Positions({2}));
+  ASSERT_EQ(result.added_crates.size(), 1u);
+  EXPECT_EQ(result.added_crates[0].name, "New");
+  EXPECT_EQ(result.added_crates[0].added_tracks, Positions({1}));
+}
+
+TEST(LibraryDiffTest, SubcratesAreNamedAfterTheirParents) {
+  Library before = makeLibrary({"a.mp3", "b.mp3"});
+  Crate house = makeCrate("House", before, {0});
+  house.subcrates.push_back(makeCrate("Deep", before, {1}));
+  before.crates.push_back(house);
+
+  Library after = makeLibrary({"a.mp3", "b.mp3"});
+  house = makeCrate("House", after, {0});
+  house.subcrates.push_back(makeCrate("Deep", after, {0, 1}));
+  after.crates.push_back(house);
+  // A top-level crate with the same name as the subcrate is a different crate.
+  after.crates.push_back(makeCrate("Deep", after, {1}));
+
+  LibraryDiff result = diff(before, after);
+  ASSERT_EQ(result.changed_crates.size(), 1u);
+  EXPECT_EQ(result.changed_crates[0].name, "House%%Deep");
+  EXPECT_EQ(result.changed_crates[0].added_tracks, Positions({0}));
+  EXPECT_TRUE(result.changed_crates[0].removed_tracks.empty());
+  ASSERT_EQ(result.added_crates.size(), 1u);
+  EXPECT_EQ(result.added_crates[0].name, "Deep");
+}
@@ -0,0 +1,81 @@
+// This file contains LibraryHolder, for sharing a library between threads while it's reloaded.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "seratocrates.h"
+
+// ImmutableLibrary is a reference-counted handle to a Library that nobody can modify any more.
+// Copying it is cheap, and the library is freed once the last copy is destroyed.
+//
+// Library holds its tracks through shared_ptr<Track>, so it's still possible to reach a mutable
+// Track through one. Don't: other threads may be reading it.
+class ImmutableLibrary {
+public:
+  // An empty library, with version 0.
+  ImmutableLibrary() : library_(std::make_shared<const Library>()) {}
+
+  ImmutableLibrary(std::unique_ptr<Library> library, uint64_t version)
+      : library_(std::move(library)), version_(version) {}
+
+  const Library& operator*() const {
+    return *library_;
+  }
+
+  const Library* operator->() const {
+    return library_.get();
+  }
+
+  // Increases by one with each library a LibraryHolder publishes.
+  uint64_t version() const {
+    return version_;
+  }
+
+private:
+  std::shared_ptr<const Library> library_;
+  uint64_t version_ = 0;
+};
+
+// LibraryHolder holds the current version of a library. Readers call get() and use the snapshot
+// it returns for as long as they like; meanwhile a writer can publish() a new version, and an old
+// version is freed when its last reader drops it.
+//
+// get() and publish() copy and swap a shared_ptr with std::atomic_load and std::atomic_store.
+// These aren't lock-free: libstdc++ guards them with a mutex from an internal pool. So readers do
+// take a lock, but only for as long as it takes to copy or swap the pointer, never while a
+// library is read or published.
+class LibraryHolder {
+public:
+  LibraryHolder() : current_(std::make_shared<const ImmutableLibrary>()) {}
+
+  explicit LibraryHolder(std::unique_ptr<Library> library) : LibraryHolder() {
+    publish(std::move(library));
+  }
+
+  // Returns the most recently published library.
+  ImmutableLibrary get() const {
+    return *std::atomic_load(&current_);
+  }
+
+  // Makes library the current version and returns it.
+  ImmutableLibrary publish(std::unique_ptr<Library> library) {
+    // Writers are serialized so that versions are published in order.
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    std::shared_ptr<const ImmutableLibrary> next = std::make_shared<const ImmutableLibrary>(
+        std::move(library), std::atomic_load(&current_)->version() + 1);
+    std::atomic_store(&current_, next);
+    return *next;
+  }
+
+  // Reads the library at path (as for readLibrary) and publishes it. If reading throws, the
+  // current version is left in place.
+  ImmutableLibrary reload(const std::string& path, const ReadOptions& options = ReadOptions()) {
+    return publish(readLibrary(path, options));
+  }
+
+private:
+  std::shared_ptr<const ImmutableLibrary> current_;
+  std::mutex publish_mutex_;
+};
@@ -0,0 +1,520 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "library_image.h"
+
+// The image starts with a Header, followed by the TrackRecords, the CrateRecords, the arrays of
+// track positions and crate indexes that crates refer to, and finally the string bytes. All
+// offsets are from the start of the image, and every record is 4-byte aligned.
+
+namespace {
+
+const char kMagic[8] = {'S', 'R', 'T', 'O', 'I', 'M', 'G', '1'};
+
+struct StringRef {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct Header {
+  char magic[8];
+  uint64_t size;
+  StringRef version;
+  uint32_t track_count;
+  uint32_t tracks_offset;
+  // All crates, at every nesting level.
+  uint32_t crate_count;
+  uint32_t crates_offset;
+  // Indexes in the crate records of the top-level crates.
+  uint32_t top_crate_count;
+  uint32_t top_crates_offset;
+};
+
+const size_t kTrackStrings = 8;
+
+// Crates may nest at most this deep (top-level crates are at depth 0). toLibrary and Crate's
+// destructor recurse once per level, so a bad image mustn't be able to nest crates arbitrarily.
+const size_t kMaxCrateDepth = 256;
+
+struct TrackRecord {
+  // path, title, artist, album, comment, bpm, key, length.
+  StringRef strings[kTrackStrings];
+  uint32_t date_added;
+};
+
+struct CrateRecord {
+  StringRef name;
+  StringRef version;
+  // Array of track positions.
+  uint32_t tracks_offset;
+  uint32_t track_count;
+  // Array of indexes in the crate records.
+  uint32_t subcrates_offset;
+  uint32_t subcrate_count;
+};
+
+const std::string Track::* const kTrackFields[kTrackStrings] = {
+    &Track::path, &Track::title, &Track::artist, &Track::album, &Track::comment, &Track::bpm,
+    &Track::key, &Track::length};
+
+// Lays out an image in memory.
+class ImageWriter {
+public:
+  explicit ImageWriter(const Library& library) : library_(library) {
+    for (uint32_t i = 0; i < library.tracks.size(); i++) {
+      positions_.emplace(library.tracks[i].get(), i);
+    }
+    // Number the crates breadth first, so that each crate's subcrates are consecutive.
+    std::vector<const Crate*> crates;
+    std::vector<size_t> depths;
+    for (const Crate& crate : library.crates) {
+      crates.push_back(&crate);
+      depths.push_back(0);
+    }
+    for (size_t i = 0; i < crates.size(); i++) {
+      if (depths[i] > kMaxCrateDepth) {
+        throw ReadException("Crates are nested too deeply for an image");
+      }
+      first_subcrate_.push_back(crates.size());
+      for (const Crate& subcrate : crates[i]->subcrates) {
+        crates.push_back(&subcrate);
+        depths.push_back(depths[i] + 1);
+      }
+    }
+    crates_ = std::move(crates);
+  }
+
+  std::string write() {
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.track_count = library_.tracks.size();
+    header.crate_count = crates_.size();
+    header.top_crate_count = library_.crates.size();
+
+    size_t offset = sizeof(Header);
+    header.tracks_offset = offset;
+    offset += sizeof(TrackRecord) * library_.tracks.size();
+    header.crates_offset = offset;
+    offset += sizeof(CrateRecord) * crates_.size();
+    header.top_crates_offset = offset;
+    offset += sizeof(uint32_t) * library_.crates.size();
+    size_t lists_offset = offset;
+    for (const Crate* crate : crates_) {
+      offset += sizeof(uint32_t) * (crate->tracks.size() + crate->subcrates.size());
+    }
+    strings_offset_ = offset;
+    for (const std::shared_ptr<Track>& track : library_.tracks) {
+      for (const std::string Track::* field : kTrackFields) {
+        offset += ((*track).*field).size();
+      }
+    }
+    for (const Crate* crate : crates_) {
+      offset += crate->name.size() + crate->version.size();
+    }
+    offset += library_.version.size();
+    if (offset > UINT32_MAX) {
+      throw ReadException("Library is too large for an image");
+    }
+    header.size = offset;
+
+    image_.assign(offset, '\0');
+    next_string_ = strings_offset_;
+    header.version = addString(library_.version);
+    memcpy(&image_[0], &header, sizeof(header));
+
+    for (size_t i = 0; i < library_.tracks.size(); i++) {
+      const Track& track = *library_.tracks[i];
+      TrackRecord record{};
+      for (size_t f = 0; f < kTrackStrings; f++) {
+        record.strings[f] = addString(track.*kTrackFields[f]);
+      }
+      record.date_added = track.date_added;
+      put(header.tracks_offset + i * sizeof(TrackRecord), record);
+    }
+
+    for (size_t i = 0; i < library_.crates.size(); i++) {
+      put<uint32_t>(header.top_crates_offset + i * sizeof(uint32_t), i);
+    }
+
+    size_t list = lists_offset;
+    for (size_t i = 0; i < crates_.size(); i++) {
+      const Crate& crate = *crates_[i];
+      CrateRecord record{};
+      record.name = addString(crate.name);
+      record.version = addString(crate.version);
+      record.tracks_offset = list;
+      for (const std::shared_ptr<Track>& track : crate.tracks) {
+        auto it = positions_.find(track.get());
+        if (it == positions_.end()) {
+          throw ReadException("Crate " + crate.name + " has a track that isn't in the library");
+        }
+        put<uint32_t>(list, it->second);
+        list += sizeof(uint32_t);
+        record.track_count++;
+      }
+      record.subcrates_offset = list;
+      for (size_t j = 0; j < crate.subcrates.size(); j++) {
+        put<uint32_t>(list, first_subcrate_[i] + j);
+        list += sizeof(uint32_t);
+        record.subcrate_count++;
+      }
+      put(header.crates_offset + i * sizeof(CrateRecord), record);
+    }
+    return std::move(image_);
+  }
+
+private:
+  template<typename T>
+  void put(size_t offset, const T& value) {
+    memcpy(&image_[offset], &value, sizeof(T));
+  }
+
+  StringRef addString(const std::string& str) {
+    StringRef ret{static_cast<uint32_t>(next_string_), static_cast<uint32_t>(str.size())};
+    memcpy(&image_[next_string_], str.data(), str.size());
+    next_string_ += str.size();
+    return ret;
+  }
+
+  const Library& library_;
+  std::unordered_map<const Track*, uint32_t> positions_;
+  std::vector<const Crate*> crates_;
+  // Index of the first subcrate of each crate.
+  std::vector<size_t> first_subcrate_;
+  std::string image_;
+  size_t strings_offset_ = 0;
+  size_t next_string_ = 0;
+};
+
+bool inBounds(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+// Checks that every offset in the image stays within it. Returns an error message, or an empty
+// string if the image is good.
+std::string validate(const char* data, size_t size) {
+  if (size < sizeof(Header)) {
+    return "image is truncated";
+  }
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    return "not a library image";
+  }
+  if (header.size != size) {
+    return "image size doesn't match";
+  }
+  if (!inBounds(header.version.offset, header.version.size, size)) {
+    return "bad version string";
+  }
+  if (!inBounds(header.tracks_offset, uint64_t(header.track_count) * sizeof(TrackRecord), size)
+      || !inBounds(header.crates_offset, uint64_t(header.crate_count) * sizeof(CrateRecord), size)
+      || !inBounds(header.top_crates_offset, uint64_t(header.top_crate_count) * sizeof(uint32_t),
+                   size)
+      || header.tracks_offset % 4 || header.crates_offset % 4 || header.top_crates_offset % 4) {
+    return "bad table offsets";
+  }
+  auto string_ok = [&](const StringRef& ref) {
+    return inBounds(ref.offset, ref.size, size);
+  };
+  // Every crate must be listed exactly once, either as a top-level crate or as one crate's
+  // subcrate, so that the crates form a tree. depths[i] is the depth of crate i, or -1 until it's
+  // listed.
+  std::vector<int> depths(header.crate_count, -1);
+  const uint32_t* top = reinterpret_cast<const uint32_t*>(data + header.top_crates_offset);
+  for (uint32_t i = 0; i < header.top_crate_count; i++) {
+    if (top[i] >= header.crate_count || depths[top[i]] >= 0) {
+      return "bad top-level crate";
+    }
+    depths[top[i]] = 0;
+  }
+  const TrackRecord* tracks = reinterpret_cast<const TrackRecord*>(data + header.tracks_offset);
+  for (uint32_t i = 0; i < header.track_count; i++) {
+    for (const StringRef& ref : tracks[i].strings) {
+      if (!string_ok(ref)) {
+        return "bad track string";
+      }
+    }
+  }
+  const CrateRecord* crates = reinterpret_cast<const CrateRecord*>(data + header.crates_offset);
+  for (uint32_t i = 0; i < header.crate_count; i++) {
+    const CrateRecord& crate = crates[i];
+    if (!string_ok(crate.name) || !string_ok(crate.version)
+        || !inBounds(crate.tracks_offset, uint64_t(crate.track_count) * sizeof(uint32_t), size)
+        || !inBounds(crate.subcrates_offset, uint64_t(crate.subcrate_count) * sizeof(uint32_t),
+                     size)
+        || crate.tracks_offset % 4 || crate.subcrates_offset % 4) {
+      return "bad crate record";
+    }
+    const uint32_t* positions = reinterpret_cast<const uint32_t*>(data + crate.tracks_offset);
+    for (uint32_t j = 0; j < crate.track_count; j++) {
+      if (positions[j] >= header.track_count) {
+        return "bad crate track";
+      }
+    }
+    // Subcrates always come after their parent, so a crate's depth is known by the time it's
+    // checked here (if it isn't, nothing listed it).
+    if (depths[i] < 0) {
+      return "unlisted crate";
+    }
+    const uint32_t* subcrates = reinterpret_cast<const uint32_t*>(data + crate.subcrates_offset);
+    for (uint32_t j = 0; j < crate.subcrate_count; j++) {
+      if (subcrates[j] <= i || subcrates[j] >= header.crate_count || depths[subcrates[j]] >= 0
+          || size_t(depths[i]) >= kMaxCrateDepth) {
+        return "bad subcrate";
+      }
+      depths[subcrates[j]] = depths[i] + 1;
+    }
+  }
+  return "";
+}
+
+// Writes image into fd, which must be empty.
+void writeImage(int fd, const std::string& image) {
+  if (ftruncate(fd, image.size()) != 0) {
+    throw ReadException("Could not size library image");
+  }
+  size_t written = 0;
+  while (written < image.size()) {
+    ssize_t n = pwrite(fd, image.data() + written, image.size() - written, written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw ReadException("Could not write library image");
+    }
+    written += n;
+  }
+}
+
+}  // namespace
+
+
+namespace {
+
+// Maps fd and closes it, whether or not mapping succeeds.
+std::unique_ptr<LibraryImage> mapAndClose(int fd) {
+  try {
+    std::unique_ptr<LibraryImage> ret = LibraryImage::map(fd);
+    close(fd);
+    return ret;
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<LibraryImage> LibraryImage::build(const Library& library) {
+  std::string image = ImageWriter(library).write();
+#ifdef MFD_ALLOW_SEALING
+  int fd = memfd_create("serato-library", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    throw ReadException("Could not create memfd for library image");
+  }
+  try {
+    writeImage(fd, image);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    close(fd);
+    throw ReadException("Could not seal library image");
+  }
+#else
+  // Without memfd, use an anonymous shared memory object.
+  std::string name = "/serato-library-" + std::to_string(getpid());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw ReadException("Could not create shared memory for library image");
+  }
+  shm_unlink(name.c_str());
+  try {
+    writeImage(fd, image);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+#endif
+  return mapAndClose(fd);
+}
+
+std::unique_ptr<LibraryImage> LibraryImage::buildShared(
+    const Library& library, const std::string& name) {
+  std::string image = ImageWriter(library).write();
+  // Write under a temporary name and then rename, so that a process mapping name never sees a
+  // half-written image. POSIX has no rename for shared memory objects, but on Linux they're files
+  // in /dev/shm.
+  //
+  // Shared memory objects can't be sealed, so the object is created read-only for everyone: once
+  // this fd is closed, only the owner (by changing the mode back) or root can modify it.
+  std::string temp_name = name + ".tmp." + std::to_string(getpid());
+  shm_unlink(temp_name.c_str());
+  int fd = shm_open(temp_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+  if (fd < 0) {
+    throw ReadException("Could not create shared memory object " + temp_name);
+  }
+  std::unique_ptr<LibraryImage> ret;
+  try {
+    writeImage(fd, image);
+    // Map before publishing, so that a failure doesn't leave an image under name.
+    ret = map(fd);
+    if (rename(("/dev/shm" + temp_name).c_str(), ("/dev/shm" + name).c_str()) != 0) {
+      throw ReadException("Could not publish shared memory object " + name);
+    }
+  } catch (...) {
+    shm_unlink(temp_name.c_str());
+    close(fd);
+    throw;
+  }
+  close(fd);
+  return ret;
+}
+
+std::unique_ptr<LibraryImage> LibraryImage::map(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw ReadException("Could not stat library image");
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(Header)) {
+    throw ReadException("Bad library image: image is truncated");
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    throw ReadException("Could not map library image");
+  }
+  const char* data = static_cast<const char*>(mapping);
+  std::string error = validate(data, size);
+  if (!error.empty()) {
+    munmap(mapping, size);
+    throw ReadException("Bad library image: " + error);
+  }
+  int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (own_fd < 0) {
+    munmap(mapping, size);
+    throw ReadException("Could not duplicate library image descriptor");
+  }
+  return std::unique_ptr<LibraryImage>(new LibraryImage(own_fd, data, size));
+}
+
+std::unique_ptr<LibraryImage> LibraryImage::mapShared(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    throw ReadException("Could not open shared memory object " + name);
+  }
+  return mapAndClose(fd);
+}
+
+LibraryImage::~LibraryImage() {
+  munmap(const_cast<char*>(data_), size_);
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+size_t LibraryImage::trackCount() const {
+  return at<Header>(0).track_count;
+}
+
+ImageTrack LibraryImage::track(size_t pos) const {
+  const TrackRecord& record =
+      at<TrackRecord>(at<Header>(0).tracks_offset + pos * sizeof(TrackRecord));
+  std::string_view strings[kTrackStrings];
+  for (size_t f = 0; f < kTrackStrings; f++) {
+    strings[f] = std::string_view(data_ + record.strings[f].offset, record.strings[f].size);
+  }
+  return ImageTrack{strings[0], strings[1], strings[2], strings[3], strings[4], strings[5],
+                    strings[6], strings[7], record.date_added};
+}
+
+size_t LibraryImage::crateCount() const {
+  return at<Header>(0).top_crate_count;
+}
+
+ImageCrate LibraryImage::crate(size_t i) const {
+  const Header& header = at<Header>(0);
+  uint32_t index = at<uint32_t>(header.top_crates_offset + i * sizeof(uint32_t));
+  return ImageCrate(this, header.crates_offset + index * sizeof(CrateRecord));
+}
+
+namespace {
+
+void decodeCrate(const ImageCrate& image_crate,
+                 const std::vector<std::shared_ptr<Track>>& tracks, Crate* crate) {
+  crate->name = std::string(image_crate.name());
+  crate->version = std::string(image_crate.version());
+  for (size_t i = 0; i < image_crate.trackCount(); i++) {
+    crate->tracks.push_back(tracks[image_crate.trackPosition(i)]);
+  }
+  crate->subcrates.resize(image_crate.subcrateCount());
+  for (size_t i = 0; i < crate->subcrates.size(); i++) {
+    decodeCrate(image_crate.subcrate(i), tracks, &crate->subcrates[i]);
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<Library> LibraryImage::toLibrary() const {
+  std::unique_ptr<Library> ret = std::make_unique<Library>();
+  const StringRef& version = at<Header>(0).version;
+  ret->version = std::string(data_ + version.offset, version.size);
+  ret->tracks.reserve(trackCount());
+  for (size_t i = 0; i < trackCount(); i++) {
+    ImageTrack image_track = track(i);
+    std::shared_ptr<Track> track = std::make_shared<Track>();
+    track->path = std::string(image_track.path);
+    track->title = std::string(image_track.title);
+    track->artist = std::string(image_track.artist);
+    track->album = std::string(image_track.album);
+    track->comment = std::string(image_track.comment);
+    track->bpm = std::string(image_track.bpm);
+    track->key = std::string(image_track.key);
+    track->length = std::string(image_track.length);
+    track->date_added = image_track.date_added;
+    ret->tracks.push_back(std::move(track));
+  }
+  ret->crates.resize(crateCount());
+  for (size_t i = 0; i < ret->crates.size(); i++) {
+    decodeCrate(crate(i), ret->tracks, &ret->crates[i]);
+  }
+  return ret;
+}
+
+
+std::string_view ImageCrate::name() const {
+  const CrateRecord& record = image_->at<CrateRecord>(offset_);
+  return std::string_view(image_->data_ + record.name.offset, record.name.size);
+}
+
+std::string_view ImageCrate::version() const {
+  const CrateRecord& record = image_->at<CrateRecord>(offset_);
+  return std::string_view(image_->data_ + record.version.offset, record.version.size);
+}
+
+size_t ImageCrate::trackCount() const {
+  return image_->at<CrateRecord>(offset_).track_count;
+}
+
+size_t ImageCrate::trackPosition(size_t i) const {
+  return image_->at<uint32_t>(
+      image_->at<CrateRecord>(offset_).tracks_offset + i * sizeof(uint32_t));
+}
+
+size_t ImageCrate::subcrateCount() const {
+  return image_->at<CrateRecord>(offset_).subcrate_count;
+}
+
+ImageCrate ImageCrate::subcrate(size_t i) const {
+  const CrateRecord& record = image_->at<CrateRecord>(offset_);
+  uint32_t index = image_->at<uint32_t>(record.subcrates_offset + i * sizeof(uint32_t));
+  return ImageCrate(image_, image_->at<Header>(0).crates_offset + index * sizeof(CrateRecord));
+}
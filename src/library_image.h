@@ -0,0 +1,114 @@
+// This file contains LibraryImage, a Library flattened into shared memory so that several
+// processes can use one copy.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "seratocrates.h"
+
+class LibraryImage;
+
+// A track in a LibraryImage. The strings point into the image.
+struct ImageTrack {
+  std::string_view path;
+  std::string_view title;
+  std::string_view artist;
+  std::string_view album;
+  std::string_view comment;
+  std::string_view bpm;
+  std::string_view key;
+  std::string_view length;
+  uint32_t date_added;
+};
+
+// A crate in a LibraryImage. Cheap to copy; valid as long as the image is.
+class ImageCrate {
+public:
+  ImageCrate(const LibraryImage* image, uint32_t offset) : image_(image), offset_(offset) {}
+
+  std::string_view name() const;
+  std::string_view version() const;
+  size_t trackCount() const;
+  // Position (for LibraryImage::track) of the i'th track in the crate.
+  size_t trackPosition(size_t i) const;
+  size_t subcrateCount() const;
+  ImageCrate subcrate(size_t i) const;
+
+private:
+  const LibraryImage* image_;
+  uint32_t offset_;
+};
+
+// LibraryImage is a read-only, position-independent encoding of a resolved Library: tracks and
+// crates are fixed-size records that refer to each other and to their strings by offset, so the
+// image can be mapped at any address. One process (the loader) builds the image into a memfd or a
+// POSIX shared memory object, and other processes map the same pages read-only, so the library is
+// held in memory once per host rather than once per process.
+//
+// Images are only meant to be shared between processes on the same machine (they use its byte
+// order). map() checks an image once, when it's mapped; the accessors then trust its offsets
+// without checking them again, so an image must not change while it's mapped. Images built by
+// build() are sealed memfds, which guarantees that. Shared memory objects can't be sealed, so
+// with buildShared() and mapShared() the object's owner is trusted: buildShared() creates it
+// read-only for everyone, but anyone who makes it writable and rewrites it can make mappers read
+// out of bounds or crash.
+class LibraryImage {
+public:
+  // Builds an image of library in a new memfd and maps it. Pass fd() to other processes (e.g. over
+  // a Unix socket, or by inheriting it) and have them call map(). Throws ReadException on failure,
+  // including when crates are nested more than 256 deep.
+  static std::unique_ptr<LibraryImage> build(const Library& library);
+
+  // Builds an image of library in the POSIX shared memory object with the given name (e.g.
+  // "/serato-library"), replacing it if it exists. Other processes call mapShared(name). The
+  // object persists until it's replaced or removed with shm_unlink.
+  static std::unique_ptr<LibraryImage> buildShared(const Library& library, const std::string& name);
+
+  // Maps the image in fd read-only. The image is checked before it's used, so a bad image throws
+  // ReadException rather than causing out-of-bounds reads later (as long as it doesn't change
+  // afterwards; see above). fd is duplicated, so the caller may close it.
+  static std::unique_ptr<LibraryImage> map(int fd);
+  static std::unique_ptr<LibraryImage> mapShared(const std::string& name);
+
+  ~LibraryImage();
+  LibraryImage(const LibraryImage&) = delete;
+  LibraryImage& operator=(const LibraryImage&) = delete;
+
+  // The file descriptor holding the image.
+  int fd() const {
+    return fd_;
+  }
+
+  // Size of the image in bytes.
+  size_t size() const {
+    return size_;
+  }
+
+  size_t trackCount() const;
+  // The pos'th track, in the same order as Library::tracks.
+  ImageTrack track(size_t pos) const;
+
+  // Top-level crates, as in Library::crates.
+  size_t crateCount() const;
+  ImageCrate crate(size_t i) const;
+
+  // Decodes the image back into a Library.
+  std::unique_ptr<Library> toLibrary() const;
+
+private:
+  friend class ImageCrate;
+
+  LibraryImage(int fd, const char* data, size_t size) : fd_(fd), data_(data), size_(size) {}
+
+  template<typename T>
+  const T& at(uint32_t offset) const {
+    return *reinterpret_cast<const T*>(data_ + offset);
+  }
+
+  int fd_;
+  const char* data_;
+  size_t size_;
+};
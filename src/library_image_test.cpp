@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "library_image.h"
+
+namespace {
+
+// Offsets of fields in the image header and records (see library_image.cpp).
+const size_t kVersionOffset = 16;
+const size_t kTrackCountOffset = 24;
+const size_t kTracksOffsetOffset = 28;
+const size_t kCratesOffsetOffset = 36;
+const size_t kTopCrateCountOffset = 40;
+const size_t kTopCratesOffsetOffset = 44;
+const size_t kHeaderSize = 48;
+const size_t kCrateTracksOffset = 16;
+const size_t kCrateSubcratesOffset = 24;
+
+std::shared_ptr<Track> makeTrack(const std::string& path, const std::string& title) {
+  auto track = std::make_shared<Track>();
+  track->path = path;
+  track->title = title;
+  track->artist = "Artist";
+  track->bpm = "128.00";
+  track->key = "8A";
+  track->length = "03:45.12";
+  track->date_added = 1600000000;
+  return track;
+}
+
+Library makeLibrary() {
+  Library library;
+  library.version = "1.0/Serato ScratchLive Database";
+  library.tracks = {makeTrack("Music/a.mp3", "A"), makeTrack("Music/b.mp3", "B"),
+                    makeTrack("Music/caf\xc3\xa9.mp3", "")};
+  Crate deep{"Deep", "1.0/Serato ScratchLive Crate", {library.tracks[2]}, {}};
+  Crate house{"House", "1.0/Serato ScratchLive Crate", {library.tracks[0], library.tracks[2]},
+              {deep}};
+  Crate techno{"Techno", "1.0/Serato ScratchLive Crate", {library.tracks[1]}, {}};
+  library.crates = {house, techno};
+  return library;
+}
+
+std::string readImage(const LibraryImage& image) {
+  std::string ret(image.size(), '\0');
+  EXPECT_EQ(pread(image.fd(), &ret[0], ret.size(), 0), ssize_t(ret.size()));
+  return ret;
+}
+
+uint32_t getU32(const std::string& image, size_t offset) {
+  uint32_t value;
+  memcpy(&value, &image[offset], 4);
+  return value;
+}
+
+void putU32(std::string* image, size_t offset, uint32_t value) {
+  memcpy(&(*image)[offset], &value, 4);
+}
+
+// Maps bytes as an image through a new memfd.
+std::unique_ptr<LibraryImage> mapBytes(const std::string& bytes) {
+  int fd = memfd_create("library-image-test", MFD_CLOEXEC);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(write(fd, bytes.data(), bytes.size()), ssize_t(bytes.size()));
+  std::unique_ptr<LibraryImage> ret;
+  try {
+    ret = LibraryImage::map(fd);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  return ret;
+}
+
+void expectBadImage(const std::string& bytes, const std::string& message) {
+  try {
+    mapBytes(bytes);
+    ADD_FAILURE() << "expected \"" << message << "\"";
+  } catch (const ReadException& e) {
+    EXPECT_EQ(e.what(), "Bad library image: " + message);
+  }
+}
+
+// Reads everything reachable from image, so that AddressSanitizer sees any bad offset.
+void touch(const LibraryImage& image) {
+  std::unique_ptr<Library> library = image.toLibrary();
+  for (size_t i = 0; i < image.trackCount(); i++) {
+    EXPECT_EQ(image.track(i).path, library->tracks[i]->path);
+  }
+}
+
+class LibraryImageTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    library_ = makeLibrary();
+    bytes_ = readImage(*LibraryImage::build(library_));
+  }
+
+  size_t crateOffset(size_t i) const {
+    return getU32(bytes_, kCratesOffsetOffset) + i * 32;
+  }
+
+  Library library_;
+  std::string bytes_;
+};
+
+}  // namespace
+
+TEST_F(LibraryImageTest, RoundTrips) {
+  std::unique_ptr<LibraryImage> image = LibraryImage::build(library_);
+  ASSERT_EQ(image->trackCount(), 3u);
+  EXPECT_EQ(image->track(2).path, "Music/caf\xc3\xa9.mp3");
+  EXPECT_EQ(image->track(2).title, "");
+  EXPECT_EQ(image->track(0).length, "03:45.12");
+  EXPECT_EQ(image->track(0).date_added, 1600000000u);
+
+  ASSERT_EQ(image->crateCount(), 2u);
+  ImageCrate house = image->crate(0);
+  EXPECT_EQ(house.name(), "House");
+  ASSERT_EQ(house.trackCount(), 2u);
+  EXPECT_EQ(house.trackPosition(0), 0u);
+  EXPECT_EQ(house.trackPosition(1), 2u);
+  ASSERT_EQ(house.subcrateCount(), 1u);
+  EXPECT_EQ(house.subcrate(0).name(), "Deep");
+  EXPECT_EQ(house.subcrate(0).trackPosition(0), 2u);
+  EXPECT_EQ(image->crate(1).name(), "Techno");
+
+  std::unique_ptr<Library> decoded = image->toLibrary();
+  EXPECT_EQ(decoded->version, library_.version);
+  ASSERT_EQ(decoded->tracks.size(), 3u);
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(decoded->tracks[i]->path, library_.tracks[i]->path);
+    EXPECT_EQ(decoded->tracks[i]->artist, library_.tracks[i]->artist);
+  }
+  ASSERT_EQ(decoded->crates.size(), 2u);
+  // Crates share the library's tracks rather than copies of them.
+  EXPECT_EQ(decoded->crates[0].subcrates[0].tracks[0], decoded->tracks[2]);
+}
+
+TEST_F(LibraryImageTest, RoundTripsAnEmptyLibrary) {
+  std::unique_ptr<LibraryImage> image = LibraryImage::build(Library());
+  EXPECT_EQ(image->trackCount(), 0u);
+  EXPECT_EQ(image->crateCount(), 0u);
+  EXPECT_TRUE(image->toLibrary()->tracks.empty());
+}
+
+TEST_F(LibraryImageTest, MapsAnotherProcesssCopy) {
+  std::unique_ptr<LibraryImage> image = mapBytes(bytes_);
+  touch(*image);
+  EXPECT_EQ(image->crate(0).subcrate(0).name(), "Deep");
+}
+
+TEST_F(LibraryImageTest, RejectsTruncatedImages) {
+  expectBadImage(bytes_.substr(0, kHeaderSize - 1), "image is truncated");
+  expectBadImage(bytes_.substr(0, bytes_.size() - 1), "image size doesn't match");
+  expectBadImage(bytes_ + '\0', "image size doesn't match");
+}
+
+TEST_F(LibraryImageTest, RejectsBadMagic) {
+  bytes_[7] = '2';
+  expectBadImage(bytes_, "not a library image");
+}
+
+TEST_F(LibraryImageTest, RejectsTablesOutOfBounds) {
+  std::string bytes = bytes_;
+  putU32(&bytes, kTrackCountOffset, 0x10000000);
+  expectBadImage(bytes, "bad table offsets");
+
+  bytes = bytes_;
+  putU32(&bytes, kTracksOffsetOffset, uint32_t(bytes.size()));
+  expectBadImage(bytes, "bad table offsets");
+
+  bytes = bytes_;
+  putU32(&bytes, kTopCratesOffsetOffset, UINT32_MAX - 3);
+  expectBadImage(bytes, "bad table offsets");
+}
+
+TEST_F(LibraryImageTest, RejectsMisalignedTables) {
+  std::string bytes = bytes_;
+  putU32(&bytes, kTracksOffsetOffset, getU32(bytes, kTracksOffsetOffset) + 2);
+  expectBadImage(bytes, "bad table offsets");
+}
+
+TEST_F(LibraryImageTest, RejectsStringsOutOfBounds) {
+  size_t tracks = getU32(bytes_, kTracksOffsetOffset);
+  std::string bytes = bytes_;
+  // The first track's path: offset past the end.
+  putU32(&bytes, tracks, uint32_t(bytes.size()) + 1);
+  expectBadImage(bytes, "bad track string");
+
+  bytes = bytes_;
+  // The second track's title: size overflowing when added to the offset.
+  putU32(&bytes, tracks + 68 + 12, UINT32_MAX);
+  expectBadImage(bytes, "bad track string");
+
+  bytes = bytes_;
+  putU32(&bytes, crateOffset(1) + 4, uint32_t(bytes.size()));
+  expectBadImage(bytes, "bad crate record");
+}
+
+TEST_F(LibraryImageTest, RejectsCrateTracksOutOfRange) {
+  std::string bytes = bytes_;
+  putU32(&bytes, getU32(bytes, crateOffset(0) + kCrateTracksOffset) + 4, 3);
+  expectBadImage(bytes, "bad crate track");
+}
+
+TEST_F(LibraryImageTest, RejectsSubcrateCycles) {
+  // Crate records are breadth-first: House, Techno, Deep. Point House's subcrate back at House.
+  std::string bytes = bytes_;
+  size_t subcrates = getU32(bytes, crateOffset(0) + kCrateSubcratesOffset);
+  ASSERT_EQ(getU32(bytes, subcrates), 2u);
+  putU32(&bytes, subcrates, 0);
+  expectBadImage(bytes, "bad subcrate");
+
+  bytes = bytes_;
+  putU32(&bytes, subcrates, 3);
+  expectBadImage(bytes, "bad subcrate");
+}
+
+// Crates must form a tree, so that decoding one visits each crate once.
+TEST_F(LibraryImageTest, RejectsCratesListedTwice) {
+  // Deep (crate 2) as a top-level crate as well as House's subcrate.
+  std::string bytes = bytes_;
+  putU32(&bytes, getU32(bytes, kTopCratesOffsetOffset) + 4, 2);
+  expectBadImage(bytes, "bad subcrate");
+
+  // Techno (crate 1) as House's subcrate as well as a top-level crate.
+  bytes = bytes_;
+  putU32(&bytes, getU32(bytes, crateOffset(0) + kCrateSubcratesOffset), 1);
+  expectBadImage(bytes, "bad subcrate");
+
+  bytes = bytes_;
+  putU32(&bytes, getU32(bytes, kTopCratesOffsetOffset) + 4, 0);
+  expectBadImage(bytes, "bad top-level crate");
+}
+
+TEST_F(LibraryImageTest, RejectsUnlistedCrates) {
+  std::string bytes = bytes_;
+  putU32(&bytes, kTopCrateCountOffset, 1);
+  expectBadImage(bytes, "unlisted crate");
+}
+
+TEST_F(LibraryImageTest, LimitsCrateNesting) {
+  Library library;
+  Crate* crate = nullptr;
+  for (int depth = 0; depth <= 256; depth++) {
+    std::vector<Crate>& parent = crate ? crate->subcrates : library.crates;
+    parent.push_back(Crate{"Level " + std::to_string(depth), "", {}, {}});
+    crate = &parent.back();
+  }
+  std::unique_ptr<LibraryImage> image = LibraryImage::build(library);
+  EXPECT_EQ(image->toLibrary()->crates.size(), 1u);
+
+  crate->subcrates.push_back(Crate{"Too deep", "", {}, {}});
+  EXPECT_THROW(LibraryImage::build(library), ReadException);
+}
+
+TEST_F(LibraryImageTest, RejectsBadTopLevelCrates) {
+  std::string bytes = bytes_;
+  putU32(&bytes, getU32(bytes, kTopCratesOffsetOffset), 3);
+  expectBadImage(bytes, "bad top-level crate");
+}
+
+// Overwrites each word of the header and records with values that are likely to be bad offsets.
+// Every image must either be rejected or be safe to read.
+TEST_F(LibraryImageTest, SurvivesCorruptedWords) {
+  // The version is the first string; everything before it is header, records and lists.
+  size_t records_end = getU32(bytes_, kVersionOffset);
+  ASSERT_LT(records_end, bytes_.size());
+  for (uint32_t value : {0u, 1u, 4u, uint32_t(bytes_.size()), 0x7fffffffu, UINT32_MAX}) {
+    for (size_t offset = 8; offset < records_end; offset += 4) {
+      std::string bytes = bytes_;
+      putU32(&bytes, offset, value);
+      std::unique_ptr<LibraryImage> image;
+      try {
+        image = mapBytes(bytes);
+      } catch (const ReadException&) {
+        continue;
+      }
+      touch(*image);
+    }
+  }
+}
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "library_query.h"
+
+namespace {
+
+// Once an AND's running result has fewer than 1/kFilterThreshold of all tracks set, the rest of
+// its children are applied as filters over the surviving positions.
+const size_t kFilterThreshold = 64;
+
+std::shared_ptr<Query::Node> makeNode(Query::Kind kind) {
+  std::shared_ptr<Query::Node> ret = std::make_shared<Query::Node>();
+  ret->kind = kind;
+  ret->lo = 0;
+  ret->hi = 0;
+  return ret;
+}
+
+Query rangeQuery(Query::Kind kind, double lo, double hi) {
+  std::shared_ptr<Query::Node> node = makeNode(kind);
+  node->lo = lo;
+  node->hi = hi;
+  return Query(node);
+}
+
+// Builds an AND or OR, flattening children of the same kind.
+Query combine(Query::Kind kind, const Query& a, const Query& b) {
+  std::shared_ptr<Query::Node> node = makeNode(kind);
+  for (const Query* child : {&a, &b}) {
+    if (child->node().kind == kind) {
+      node->children.insert(node->children.end(), child->node().children.begin(),
+                            child->node().children.end());
+    } else {
+      node->children.push_back(child->nodePtr());
+    }
+  }
+  return Query(node);
+}
+
+void addCrate(const Crate& crate, const std::string& prefix,
+              const std::unordered_map<const Track*, uint32_t>& positions,
+              std::unordered_map<std::string, std::vector<uint32_t>>* crates) {
+  std::string name = prefix.empty() ? crate.name : prefix + "%%" + crate.name;
+  std::vector<uint32_t>& members = (*crates)[name];
+  for (const std::shared_ptr<Track>& track : crate.tracks) {
+    auto it = positions.find(track.get());
+    if (it != positions.end()) {
+      members.push_back(it->second);
+    }
+  }
+  std::sort(members.begin(), members.end());
+  members.erase(std::unique(members.begin(), members.end()), members.end());
+  for (const Crate& subcrate : crate.subcrates) {
+    addCrate(subcrate, name, positions, crates);
+  }
+}
+
+// Keeps the positions for which keep(pos) is true. Written without a data-dependent branch so
+// that the compiler can pipeline (and, for simple predicates, vectorize) it.
+template<typename F>
+void compact(std::vector<uint32_t>* positions, F keep) {
+  size_t out = 0;
+  for (size_t i = 0; i < positions->size(); i++) {
+    uint32_t pos = (*positions)[i];
+    (*positions)[out] = pos;
+    out += keep(pos) ? 1 : 0;
+  }
+  positions->resize(out);
+}
+
+}  // namespace
+
+
+Query::Query() : node_(makeNode(Kind::kAll)) {}
+
+Query inCrate(const std::string& name) {
+  std::shared_ptr<Query::Node> node = makeNode(Query::Kind::kCrate);
+  node->crate = name;
+  return Query(node);
+}
+
+Query bpmBetween(double lo, double hi) {
+  return rangeQuery(Query::Kind::kBpm, lo, hi);
+}
+
+Query keyIn(const std::vector<int>& camelot_keys) {
+  std::shared_ptr<Query::Node> node = makeNode(Query::Kind::kKey);
+  node->keys = camelot_keys;
+  return Query(node);
+}
+
+Query durationBetween(double lo, double hi) {
+  return rangeQuery(Query::Kind::kDuration, lo, hi);
+}
+
+Query addedBetween(double lo, double hi) {
+  return rangeQuery(Query::Kind::kDateAdded, lo, hi);
+}
+
+Query operator&&(const Query& a, const Query& b) {
+  return combine(Query::Kind::kAnd, a, b);
+}
+
+Query operator||(const Query& a, const Query& b) {
+  return combine(Query::Kind::kOr, a, b);
+}
+
+Query operator!(const Query& a) {
+  std::shared_ptr<Query::Node> node = makeNode(Query::Kind::kNot);
+  node->children.push_back(a.nodePtr());
+  return Query(node);
+}
+
+
+QueryEngine::QueryEngine(const Library& library) : library_(library), indexes_(library) {
+  std::unordered_map<const Track*, uint32_t> positions;
+  positions.reserve(library.tracks.size());
+  for (uint32_t i = 0; i < library.tracks.size(); i++) {
+    const Track& track = *library.tracks[i];
+    positions.emplace(&track, i);
+    bpm_.push_back(parseBpm(track.bpm));
+    int key = parseCamelotKey(track.key);
+    key_.push_back(key < 0 ? NAN : key);
+    duration_.push_back(parseDuration(track.length));
+    date_added_.push_back(track.date_added == 0 ? NAN : static_cast<double>(track.date_added));
+  }
+  for (const Crate& crate : library.crates) {
+    addCrate(crate, "", positions, &crates_);
+  }
+}
+
+const std::vector<uint32_t>& QueryEngine::cratePositions(const std::string& name) const {
+  static const std::vector<uint32_t> kEmpty;
+  auto it = crates_.find(name);
+  return it == crates_.end() ? kEmpty : it->second;
+}
+
+size_t QueryEngine::estimate(const Node& node) const {
+  size_t track_count = library_.tracks.size();
+  switch (node.kind) {
+    case Query::Kind::kAll:
+      return track_count;
+    case Query::Kind::kCrate:
+      return cratePositions(node.crate).size();
+    case Query::Kind::kBpm:
+      return indexes_.bpm.count(node.lo, node.hi);
+    case Query::Kind::kDuration:
+      return indexes_.duration.count(node.lo, node.hi);
+    case Query::Kind::kDateAdded:
+      return indexes_.date_added.count(node.lo, node.hi);
+    case Query::Kind::kKey: {
+      size_t ret = 0;
+      for (int key : node.keys) {
+        ret += indexes_.key.count(key, key);
+      }
+      return ret;
+    }
+    case Query::Kind::kAnd: {
+      size_t ret = track_count;
+      for (const auto& child : node.children) {
+        ret = std::min(ret, estimate(*child));
+      }
+      return ret;
+    }
+    case Query::Kind::kOr: {
+      size_t ret = 0;
+      for (const auto& child : node.children) {
+        ret += estimate(*child);
+      }
+      return std::min(ret, track_count);
+    }
+    case Query::Kind::kNot:
+      return track_count - std::min(track_count, estimate(*node.children[0]));
+  }
+  return track_count;
+}
+
+TrackBitmap QueryEngine::evaluate(const Node& node) const {
+  size_t track_count = library_.tracks.size();
+  switch (node.kind) {
+    case Query::Kind::kAll:
+      return TrackBitmap(track_count, true);
+    case Query::Kind::kCrate: {
+      TrackBitmap ret(track_count);
+      for (uint32_t pos : cratePositions(node.crate)) {
+        ret.set(pos);
+      }
+      return ret;
+    }
+    case Query::Kind::kBpm:
+      return indexes_.bpm.rangeBitmap(node.lo, node.hi);
+    case Query::Kind::kDuration:
+      return indexes_.duration.rangeBitmap(node.lo, node.hi);
+    case Query::Kind::kDateAdded:
+      return indexes_.date_added.rangeBitmap(node.lo, node.hi);
+    case Query::Kind::kKey:
+      return indexes_.keys(node.keys);
+    case Query::Kind::kAnd:
+      return evaluateAnd(node);
+    case Query::Kind::kOr: {
+      TrackBitmap ret(track_count);
+      for (const auto& child : node.children) {
+        ret |= evaluate(*child);
+      }
+      return ret;
+    }
+    case Query::Kind::kNot:
+      return evaluate(*node.children[0]).flip();
+  }
+  return TrackBitmap(track_count);
+}
+
+TrackBitmap QueryEngine::evaluateAnd(const Node& node) const {
+  size_t track_count = library_.tracks.size();
+
+  // Plan: most selective children first. A NOT's estimate is large when its child is selective,
+  // so NOTs naturally sort late, where they're applied as cheap exclusions.
+  std::vector<std::pair<size_t, const Node*>> plan;
+  for (const auto& child : node.children) {
+    plan.emplace_back(estimate(*child), child.get());
+  }
+  std::stable_sort(plan.begin(), plan.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  TrackBitmap ret(track_count, true);
+  size_t i = 0;
+  for (; i < plan.size(); i++) {
+    const Node& child = *plan[i].second;
+    if (child.kind == Query::Kind::kNot) {
+      ret.andNot(evaluate(*child.children[0]));
+    } else {
+      ret &= evaluate(child);
+    }
+    if (ret.count() * kFilterThreshold < track_count) {
+      i++;
+      break;
+    }
+  }
+  if (i == plan.size()) {
+    return ret;
+  }
+
+  // Few tracks are left, so filter them rather than building bitmaps for the remaining children.
+  std::vector<size_t> set = ret.positions();
+  std::vector<uint32_t> positions(set.begin(), set.end());
+  for (; i < plan.size() && !positions.empty(); i++) {
+    filter(*plan[i].second, &positions);
+  }
+  TrackBitmap filtered(track_count);
+  for (uint32_t pos : positions) {
+    filtered.set(pos);
+  }
+  return filtered;
+}
+
+void QueryEngine::filter(const Node& node, std::vector<uint32_t>* positions) const {
+  auto in_range = [&](const std::vector<double>& column) {
+    double lo = node.lo;
+    double hi = node.hi;
+    const double* values = column.data();
+    // NaN (no value) fails both comparisons.
+    compact(positions, [=](uint32_t pos) { return values[pos] >= lo && values[pos] <= hi; });
+  };
+
+  switch (node.kind) {
+    case Query::Kind::kAll:
+      return;
+    case Query::Kind::kBpm:
+      return in_range(bpm_);
+    case Query::Kind::kDuration:
+      return in_range(duration_);
+    case Query::Kind::kDateAdded:
+      return in_range(date_added_);
+    case Query::Kind::kKey: {
+      uint32_t mask = 0;
+      for (int key : node.keys) {
+        if (key >= 0 && key < 24) {
+          mask |= uint32_t(1) << key;
+        }
+      }
+      const double* values = key_.data();
+      compact(positions, [=](uint32_t pos) {
+        return !std::isnan(values[pos]) && (mask >> static_cast<int>(values[pos]) & 1);
+      });
+      return;
+    }
+    case Query::Kind::kCrate: {
+      // Both lists are sorted, so this is a merge.
+      const std::vector<uint32_t>& members = cratePositions(node.crate);
+      std::vector<uint32_t> out;
+      std::set_intersection(positions->begin(), positions->end(), members.begin(), members.end(),
+                            std::back_inserter(out));
+      positions->swap(out);
+      return;
+    }
+    default: {
+      // Compound children fall back to a bitmap.
+      TrackBitmap matches = evaluate(node);
+      compact(positions, [&](uint32_t pos) { return matches.test(pos); });
+      return;
+    }
+  }
+}
+
+TrackView QueryEngine::run(const Query& query) const {
+  std::vector<size_t> set = evaluate(query.node()).positions();
+  return TrackView(&library_, std::vector<uint32_t>(set.begin(), set.end()));
+}
@@ -0,0 +1,137 @@
+// This file contains a small query language over a Library's tracks and an engine that runs it
+// against crate memberships and the column indexes in track_indexes.h.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "seratocrates.h"
+#include "track_indexes.h"
+
+// A query is a tree of predicates over tracks, built with the functions and operators below. For
+// example:
+//   Query q = inCrate("House") && bpmBetween(120, 126) && !inCrate("Played");
+// Queries are immutable and cheap to copy.
+class Query {
+public:
+  enum class Kind {
+    kAll,
+    kCrate,
+    kBpm,
+    kKey,
+    kDuration,
+    kDateAdded,
+    kAnd,
+    kOr,
+    kNot,
+  };
+
+  struct Node {
+    Kind kind;
+    // kCrate.
+    std::string crate;
+    // kBpm, kDuration and kDateAdded match lo <= value <= hi.
+    double lo;
+    double hi;
+    // kKey. Camelot keys as returned by parseCamelotKey.
+    std::vector<int> keys;
+    // kAnd, kOr and kNot (which has exactly one child).
+    std::vector<std::shared_ptr<const Node>> children;
+  };
+
+  // Matches every track.
+  Query();
+  explicit Query(std::shared_ptr<const Node> node) : node_(std::move(node)) {}
+
+  const Node& node() const {
+    return *node_;
+  }
+
+  const std::shared_ptr<const Node>& nodePtr() const {
+    return node_;
+  }
+
+private:
+  std::shared_ptr<const Node> node_;
+};
+
+// Tracks in the crate with the given name. Subcrates are named the way Serato names their files,
+// e.g. "Parent%%Child". Tracks that are only in a subcrate don't match its parent.
+Query inCrate(const std::string& name);
+Query bpmBetween(double lo, double hi);
+// Any of the given Camelot keys; see parseCamelotKey and compatibleCamelotKeys.
+Query keyIn(const std::vector<int>& camelot_keys);
+// Seconds.
+Query durationBetween(double lo, double hi);
+// Seconds since the Unix epoch.
+Query addedBetween(double lo, double hi);
+
+Query operator&&(const Query& a, const Query& b);
+Query operator||(const Query& a, const Query& b);
+Query operator!(const Query& a);
+
+// The result of a query: positions in Library::tracks, in ascending order. It refers to the
+// library the QueryEngine was built from, which must outlive it.
+class TrackView {
+public:
+  TrackView(const Library* library, std::vector<uint32_t> positions)
+      : library_(library), positions_(std::move(positions)) {}
+
+  size_t size() const {
+    return positions_.size();
+  }
+
+  const Track& operator[](size_t i) const {
+    return *library_->tracks[positions_[i]];
+  }
+
+  const std::vector<uint32_t>& positions() const {
+    return positions_;
+  }
+
+private:
+  const Library* library_;
+  std::vector<uint32_t> positions_;
+};
+
+// Runs queries against one Library. Construction builds the column indexes and crate
+// memberships once; queries are then read-only and may run concurrently.
+//
+// Before running a query, the engine plans it: the children of each AND are ordered by estimated
+// result size (from crate sizes and column index counts), so the most selective predicate runs
+// first. Its result is a bitmap; once that's small, the remaining predicates are applied as a
+// filter over the surviving track positions instead of building more bitmaps.
+class QueryEngine {
+public:
+  explicit QueryEngine(const Library& library);
+
+  TrackView run(const Query& query) const;
+
+  // Estimated number of matching tracks, as used by the planner.
+  size_t estimate(const Query& query) const {
+    return estimate(query.node());
+  }
+
+private:
+  typedef Query::Node Node;
+
+  size_t estimate(const Node& node) const;
+  TrackBitmap evaluate(const Node& node) const;
+  TrackBitmap evaluateAnd(const Node& node) const;
+  // Removes positions that don't match node.
+  void filter(const Node& node, std::vector<uint32_t>* positions) const;
+  const std::vector<uint32_t>& cratePositions(const std::string& name) const;
+
+  const Library& library_;
+  TrackIndexes indexes_;
+  // Parsed column values by track position, for filtering. NaN means no value.
+  std::vector<double> bpm_;
+  std::vector<double> key_;
+  std::vector<double> duration_;
+  std::vector<double> date_added_;
+  // Sorted track positions of each crate, by Serato's name for it ("Parent%%Child").
+  std::unordered_map<std::string, std::vector<uint32_t>> crates_;
+};
@@ -0,0 +1,232 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <set>
+
+#include "library_query.h"
+
+namespace {
+
+// A library with a spread of column values, some missing or malformed, and nested crates:
+// "A", "A%%B" and "C".
+class LibraryQueryTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    const char* keys[] = {"8A", "Am", "9B", "F#", "1m", "", "H"};
+    const char* lengths[] = {"03:45.12", "1:02:03", "245", "", "bad"};
+    std::mt19937 rng(1);
+    Crate a{"A", "", {}, {}};
+    Crate b{"B", "", {}, {}};
+    Crate c{"C", "", {}, {}};
+    for (int i = 0; i < 2000; i++) {
+      auto track = std::make_shared<Track>();
+      track->path = "Music/" + std::to_string(i) + ".mp3";
+      if (i % 17 != 0) {
+        track->bpm = std::to_string(90 + rng() % 60) + ".00";
+      }
+      track->key = keys[rng() % 7];
+      track->length = lengths[rng() % 5];
+      track->date_added = i % 13 == 0 ? 0 : 1500000000 + rng() % 100000000;
+      library_.tracks.push_back(track);
+      if (i % 3 == 0) {
+        a.tracks.push_back(track);
+      }
+      if (i % 100 == 1) {
+        b.tracks.push_back(track);
+      }
+      if (i % 7 == 0 || i == 1999) {
+        c.tracks.push_back(track);
+      }
+    }
+    // Duplicate membership is ignored.
+    c.tracks.push_back(c.tracks[0]);
+    a.subcrates.push_back(b);
+    library_.crates = {a, c};
+    for (const Crate& crate : library_.crates) {
+      addMembers(crate, "");
+    }
+  }
+
+  void addMembers(const Crate& crate, const std::string& prefix) {
+    std::string name = prefix.empty() ? crate.name : prefix + "%%" + crate.name;
+    for (const auto& track : crate.tracks) {
+      members_[name].insert(track.get());
+    }
+    for (const Crate& subcrate : crate.subcrates) {
+      addMembers(subcrate, name);
+    }
+  }
+
+  // Evaluates node against one track directly, without indexes or planning.
+  bool matches(const Query::Node& node, const Track& track) const {
+    auto in_range = [&](double value) {
+      return value >= node.lo && value <= node.hi;
+    };
+    switch (node.kind) {
+      case Query::Kind::kAll:
+        return true;
+      case Query::Kind::kCrate: {
+        auto it = members_.find(node.crate);
+        return it != members_.end() && it->second.count(&track);
+      }
+      case Query::Kind::kBpm:
+        return in_range(parseBpm(track.bpm));
+      case Query::Kind::kDuration:
+        return in_range(parseDuration(track.length));
+      case Query::Kind::kDateAdded:
+        return track.date_added != 0 && in_range(track.date_added);
+      case Query::Kind::kKey: {
+        int key = parseCamelotKey(track.key);
+        return key >= 0 && std::count(node.keys.begin(), node.keys.end(), key);
+      }
+      case Query::Kind::kAnd:
+        for (const auto& child : node.children) {
+          if (!matches(*child, track)) {
+            return false;
+          }
+        }
+        return true;
+      case Query::Kind::kOr:
+        for (const auto& child : node.children) {
+          if (matches(*child, track)) {
+            return true;
+          }
+        }
+        return false;
+      case Query::Kind::kNot:
+        return !matches(*node.children[0], track);
+    }
+    return false;
+  }
+
+  std::vector<uint32_t> bruteForce(const Query& query) const {
+    std::vector<uint32_t> ret;
+    for (uint32_t i = 0; i < library_.tracks.size(); i++) {
+      if (matches(query.node(), *library_.tracks[i])) {
+        ret.push_back(i);
+      }
+    }
+    return ret;
+  }
+
+  Query randomLeaf(std::mt19937* rng) const {
+    switch ((*rng)() % 5) {
+      case 0: {
+        const char* crates[] = {"A", "A%%B", "C", "B", "Missing"};
+        return inCrate(crates[(*rng)() % 5]);
+      }
+      case 1: {
+        double lo = 85 + (*rng)() % 70;
+        return bpmBetween(lo, lo + (*rng)() % 10);
+      }
+      case 2:
+        return keyIn(compatibleCamelotKeys((*rng)() % 24));
+      case 3: {
+        double lo = (*rng)() % 300;
+        return durationBetween(lo, lo + (*rng)() % 4000);
+      }
+      default: {
+        double lo = 1500000000 + (*rng)() % 100000000;
+        return addedBetween(lo, lo + (*rng)() % 5000000);
+      }
+    }
+  }
+
+  Query randomQuery(std::mt19937* rng, int depth) const {
+    if (depth == 0) {
+      return randomLeaf(rng);
+    }
+    switch ((*rng)() % 4) {
+      case 0:
+        return randomQuery(rng, depth - 1) && randomQuery(rng, depth - 1);
+      case 1:
+        return randomQuery(rng, depth - 1) || randomQuery(rng, depth - 1);
+      case 2:
+        return !randomQuery(rng, depth - 1);
+      default:
+        return randomLeaf(rng);
+    }
+  }
+
+  Library library_;
+  std::map<std::string, std::set<const Track*>> members_;
+};
+
+}  // namespace
+
+TEST_F(LibraryQueryTest, ParsesColumns) {
+  EXPECT_EQ(parseBpm("128.00"), 128.0);
+  EXPECT_TRUE(std::isnan(parseBpm("")));
+  EXPECT_EQ(parseDuration("03:45.12"), 225.12);
+  EXPECT_EQ(parseDuration("1:02:03"), 3723.0);
+  EXPECT_TRUE(std::isnan(parseDuration("bad")));
+  EXPECT_EQ(parseCamelotKey("8A"), 14);
+  EXPECT_EQ(parseCamelotKey("Am"), 14);
+  EXPECT_EQ(parseCamelotKey("12B"), 23);
+  EXPECT_EQ(parseCamelotKey("H"), -1);
+  std::vector<int> compatible = compatibleCamelotKeys(0);
+  EXPECT_EQ(std::set<int>(compatible.begin(), compatible.end()), std::set<int>({0, 1, 2, 22}));
+}
+
+TEST_F(LibraryQueryTest, MatchesEverythingByDefault) {
+  QueryEngine engine(library_);
+  EXPECT_EQ(engine.run(Query()).size(), library_.tracks.size());
+}
+
+TEST_F(LibraryQueryTest, SubcrateTracksDontMatchTheParent) {
+  QueryEngine engine(library_);
+  EXPECT_EQ(engine.run(inCrate("A%%B")).positions(), bruteForce(inCrate("A%%B")));
+  EXPECT_TRUE(engine.run(inCrate("B")).positions().empty());
+  // Track 1 is only in A%%B.
+  std::vector<uint32_t> a = engine.run(inCrate("A")).positions();
+  EXPECT_FALSE(std::binary_search(a.begin(), a.end(), 1u));
+  EXPECT_EQ(a, bruteForce(inCrate("A")));
+  EXPECT_EQ(engine.run(inCrate("C")).size(), members_["C"].size());
+}
+
+TEST_F(LibraryQueryTest, MissingValuesOnlyMatchNegations) {
+  QueryEngine engine(library_);
+  Query all_bpms = bpmBetween(-INFINITY, INFINITY);
+  EXPECT_EQ(engine.run(all_bpms).positions(), bruteForce(all_bpms));
+  EXPECT_EQ(engine.run(!all_bpms).size(), (library_.tracks.size() + 16) / 17);
+}
+
+// A selective crate first drops the AND below the filter threshold, so the remaining children
+// are applied as filters over positions rather than bitmaps.
+TEST_F(LibraryQueryTest, FilteringMatchesBitmaps) {
+  QueryEngine engine(library_);
+  Query selective = inCrate("A%%B");
+  for (const Query& rest :
+       {bpmBetween(100, 130), keyIn({14, 15}), durationBetween(200, 4000),
+        addedBetween(1500000000, 1550000000), !inCrate("C"), inCrate("C") || bpmBetween(90, 95)}) {
+    Query query = rest && selective;
+    EXPECT_EQ(engine.run(query).positions(), bruteForce(query));
+  }
+}
+
+TEST_F(LibraryQueryTest, PlannerMatchesBruteForce) {
+  QueryEngine engine(library_);
+  std::mt19937 rng(2);
+  for (int i = 0; i < 500; i++) {
+    Query query = randomQuery(&rng, 4);
+    EXPECT_EQ(engine.run(query).positions(), bruteForce(query)) << "query " << i;
+  }
+}
+
+TEST_F(LibraryQueryTest, Estimates) {
+  QueryEngine engine(library_);
+  size_t count = library_.tracks.size();
+  EXPECT_EQ(engine.estimate(Query()), count);
+  EXPECT_EQ(engine.estimate(inCrate("A%%B")), members_["A%%B"].size());
+  EXPECT_EQ(engine.estimate(inCrate("Missing")), 0u);
+  EXPECT_EQ(engine.estimate(!inCrate("A%%B")), count - members_["A%%B"].size());
+  EXPECT_EQ(engine.estimate(inCrate("A") && inCrate("A%%B")), members_["A%%B"].size());
+  EXPECT_EQ(engine.estimate(inCrate("A") || inCrate("C")),
+            members_["A"].size() + members_["C"].size());
+  EXPECT_EQ(engine.estimate(Query() || Query()), count);
+  Query bpm = bpmBetween(100, 110);
+  EXPECT_EQ(engine.estimate(bpm), bruteForce(bpm).size());
+}
@@ -0,0 +1,223 @@
+// This file contains the steps that readLibrary is built from. They're declared here, rather than
+// hidden in seratocrates.cpp, so that benchmarks and other loaders can run them individually.
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "seratocrates.h"
+#include "path_normalization.h"
+#include "perf_counters.h"
+#include "read_disk_files.h"
+#include "track_index.h"
+#include "tracer.h"
+
+// Returns the LoadStats member that holds the hardware counters for a phase, given the member
+// that holds its time.
+inline HardwareCounters LoadStats::*phaseCounters(double LoadStats::*phase) {
+  if (phase == &LoadStats::database_seconds) {
+    return &LoadStats::database_counters;
+  } else if (phase == &LoadStats::list_crates_seconds) {
+    return &LoadStats::list_crates_counters;
+  } else if (phase == &LoadStats::parse_crates_seconds) {
+    return &LoadStats::parse_crates_counters;
+  } else if (phase == &LoadStats::resolve_seconds) {
+    return &LoadStats::resolve_counters;
+  }
+  return &LoadStats::nest_counters;
+}
+
+// Returns the name of a phase's spans in a trace.
+inline const char* phaseName(double LoadStats::*phase) {
+  if (phase == &LoadStats::database_seconds) {
+    return "database";
+  } else if (phase == &LoadStats::list_crates_seconds) {
+    return "list crates";
+  } else if (phase == &LoadStats::parse_crates_seconds) {
+    return "parse crates";
+  } else if (phase == &LoadStats::resolve_seconds) {
+    return "resolve";
+  }
+  return "nest crates";
+}
+
+// Adds the wall time between its construction and destruction to a LoadStats phase, along with
+// the phase's hardware counters if options.count_hardware_events is set, and records it as a span
+// in options.tracer. Does nothing (not even reading the clock) if options.stats and
+// options.tracer are null.
+class PhaseTimer {
+public:
+  PhaseTimer(const ReadOptions& options, double LoadStats::*phase)
+      : span_(options.tracer, phaseName(phase)), stats_(options.stats),
+        seconds_(stats_ ? &(stats_->*phase) : nullptr) {
+    if (!seconds_) {
+      return;
+    }
+    if (options.count_hardware_events && (perf_ = PerfCounters::forThisThread())) {
+      counters_ = &(stats_->*phaseCounters(phase));
+      counters_start_ = perf_->read();
+    }
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~PhaseTimer() {
+    if (!seconds_) {
+      return;
+    }
+    *seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    if (perf_) {
+      addCounters(counters_, countersSince(counters_start_, perf_->read()));
+      stats_->hardware_counters_available = true;
+    }
+  }
+
+private:
+  TraceSpan span_;
+  LoadStats* stats_;
+  double* seconds_;
+  std::chrono::steady_clock::time_point start_;
+  PerfCounters* perf_ = nullptr;
+  HardwareCounters* counters_ = nullptr;
+  HardwareCounters counters_start_;
+};
+
+// Finds crate tracks in the database by path, the way readLibrary does: exactly, and then (if
+// options.match_normalized_paths is set) ignoring case and normalization form. It can be built over
+// a track list or over a plain list of paths; either must outlive the PathResolver (see
+// TrackIndex).
+class PathResolver {
+public:
+  PathResolver(
+      const std::vector<std::shared_ptr<Track>>& tracks, const ReadOptions& options = ReadOptions())
+      : tracks_(&tracks), index_(tracks), options_(options) {}
+
+  PathResolver(const std::vector<std::string>& paths, const ReadOptions& options = ReadOptions())
+      : paths_(&paths), index_(paths), options_(options) {}
+
+  // Returns the position of the track with the given path, or TrackIndex::kNotFound (in which
+  // case it's counted in LoadStats::unresolved_crate_tracks).
+  size_t find(const std::string& path) {
+    size_t pos = index_.find(path);
+    if (pos == TrackIndex::kNotFound && options_.match_normalized_paths) {
+      pos = findNormalized(path);
+    }
+    if (pos == TrackIndex::kNotFound && options_.stats) {
+      options_.stats->unresolved_crate_tracks++;
+    }
+    return pos;
+  }
+
+private:
+  size_t size() const {
+    return tracks_ ? tracks_->size() : paths_->size();
+  }
+
+  const std::string& pathAt(size_t pos) const {
+    return tracks_ ? (*tracks_)[pos]->path : (*paths_)[pos];
+  }
+
+  size_t findNormalized(const std::string& path) {
+    if (!normalized_index_) {
+      normalized_paths_.reserve(size());
+      for (size_t i = 0; i < size(); i++) {
+        normalized_paths_.push_back(normalizePathKey(pathAt(i)));
+      }
+      normalized_index_.emplace(normalized_paths_);
+    }
+    return normalized_index_->find(normalizePathKey(path));
+  }
+
+  const std::vector<std::shared_ptr<Track>>* tracks_ = nullptr;
+  const std::vector<std::string>* paths_ = nullptr;
+  TrackIndex index_;
+  ReadOptions options_;
+
+  // Built on the first exact-match miss when options_.match_normalized_paths is set.
+  std::vector<std::string> normalized_paths_;
+  std::optional<TrackIndex> normalized_index_;
+};
+
+// library_tracks must outlive the CrateReader; see TrackIndex.
+class CrateReader {
+public:
+  CrateReader(
+      const std::vector<std::shared_ptr<Track>>& library_tracks,
+      const ReadOptions& options = ReadOptions())
+      : library_tracks_(library_tracks), resolver_(library_tracks, options), options_(options) {}
+
+  Crate read(const std::string& path) {
+    std::string data;
+    FileVersion version;
+    {
+      PhaseTimer timer(options_, &LoadStats::parse_crates_seconds);
+      data = readFile(path, options_, &version);
+    }
+    if (options_.progress) {
+      options_.progress->bytes_total += data.size();
+    }
+    return read(path, data, &version);
+  }
+
+  // Same as above, for a crate file that has already been read into memory. If version is given
+  // (the version of the file that data was read from), a crate that fails to parse is read again
+  // if the file has changed since; see parseReadFile.
+  Crate read(
+      const std::string& path, const std::string& data, const FileVersion* version = nullptr) {
+    std::unique_ptr<CrateFile> crate_file;
+    {
+      PhaseTimer timer(options_, &LoadStats::parse_crates_seconds);
+      crate_file = version ? parseReadFile<CrateFile>(path, data, *version, options_)
+                           : parseFile<CrateFile>(data, options_);
+    }
+    PhaseTimer timer(options_, &LoadStats::resolve_seconds);
+    Crate ret = *crate_file;
+    if (options_.stats) {
+      options_.stats->allocations++;
+    }
+
+    // Populate Crate::name. The crate's name is not actually stored in the .crate file itself;
+    // it's only stored in the filename.
+    ret.name = std::filesystem::path(path).stem();
+
+    for (const CrateFileTrack& crate_file_track : crate_file->tracks) {
+      size_t pos = resolver_.find(crate_file_track.path);
+      if (pos == TrackIndex::kNotFound) {
+        // Crate track was not in database, silently ignore it.
+        continue;
+      }
+      ret.tracks.push_back(library_tracks_[pos]);
+    }
+
+    return ret;
+  }
+
+private:
+  const std::vector<std::shared_ptr<Track>>& library_tracks_;
+  PathResolver resolver_;
+  ReadOptions options_;
+};
+
+// Adds from's times and counters to into.
+void addStats(LoadStats* into, const LoadStats& from);
+
+// Adds the sizes of files to progress->bytes_total, if progress isn't null.
+void addToTotal(LoadProgress* progress, const std::vector<std::string>& files);
+
+// Returns the paths of the .crate files in crates_dir, sorted by crate name.
+std::vector<std::string> listCrateFiles(const std::string& crates_dir);
+
+// Splits a crate's on-disk name ("Grandparent%%Parent%%Crate") into its pieces.
+std::vector<std::string> crateNamePieces(const std::string& name);
+
+// Take flat list of crates and create nested crate structure. See seratocrates.cpp.
+std::vector<Crate> nestCrates(std::vector<Crate>&& crates);
+
+// Returns, for each track in any of library's crates, the names of the crates that contain it.
+// Subcrates are named the way Serato names their files ("Parent%%Child").
+std::unordered_map<const Track*, std::vector<std::string>> crateNamesByTrack(
+    const Library& library);
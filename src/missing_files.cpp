@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cstdint>
+#include <dirent.h>
+#include <filesystem>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "library_reader.h"
+#include "missing_files.h"
+#include "parallel.h"
+
+namespace {
+
+// Directory listings are I/O-bound, so use more threads than there are cores.
+const size_t kListThreads = 16;
+
+// Returns the names of the entries in dir, or false if it can't be listed.
+bool listDirectory(const std::string& dir, std::unordered_set<std::string>* names) {
+  DIR* handle = opendir(dir.c_str());
+  if (handle == nullptr) {
+    return false;
+  }
+  while (dirent* entry = readdir(handle)) {
+    names->insert(entry->d_name);
+  }
+  closedir(handle);
+  return true;
+}
+
+bool exists(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+}  // namespace
+
+
+MissingFiles scanMissingFiles(const Library& library, const std::string& root) {
+  // Group tracks by directory.
+  std::unordered_map<std::string, std::vector<size_t>> by_directory;
+  std::vector<std::string> paths(library.tracks.size());
+  for (size_t i = 0; i < library.tracks.size(); i++) {
+    paths[i] = (std::filesystem::path(root) / library.tracks[i]->path).native();
+    // Directories keep their trailing slash, so a track's name is whatever follows its directory.
+    // Relative paths without a slash are in the current directory, which is keyed by "".
+    size_t slash = paths[i].rfind('/');
+    by_directory[slash == std::string::npos ? "" : paths[i].substr(0, slash + 1)].push_back(i);
+  }
+  std::vector<const std::pair<const std::string, std::vector<size_t>>*> directories;
+  for (const auto& entry : by_directory) {
+    directories.push_back(&entry);
+  }
+
+  // Not vector<bool>: its elements share words, and directories are scanned concurrently.
+  std::vector<uint8_t> missing(library.tracks.size());
+  parallelFor(directories.size(), [&](size_t d) {
+    const std::string& dir = directories[d]->first;
+    const std::vector<size_t>& tracks = directories[d]->second;
+    std::unordered_set<std::string> names;
+    bool listed = listDirectory(dir.empty() ? "." : dir, &names);
+    for (size_t pos : tracks) {
+      std::string_view name = std::string_view(paths[pos]).substr(dir.size());
+      if (listed && names.count(std::string(name))) {
+        continue;
+      }
+      // Either the directory is gone or the name isn't listed exactly. The latter can still be a
+      // match on filesystems that fold case or Unicode normalization, so ask the filesystem.
+      if (!exists(paths[pos])) {
+        missing[pos] = 1;
+      }
+    }
+  }, kListThreads);
+
+  MissingFiles ret;
+  std::unordered_map<const Track*, std::vector<std::string>> track_crates =
+      crateNamesByTrack(library);
+  for (size_t i = 0; i < missing.size(); i++) {
+    if (!missing[i]) {
+      continue;
+    }
+    ret.tracks.push_back(i);
+    auto it = track_crates.find(library.tracks[i].get());
+    ret.crates.push_back(it == track_crates.end() ? std::vector<std::string>() : it->second);
+  }
+  return ret;
+}
@@ -0,0 +1,23 @@
+// This file contains scanMissingFiles, which finds tracks whose files no longer exist.
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+struct MissingFiles {
+  // Positions in Library::tracks of tracks whose files are missing, in ascending order.
+  std::vector<size_t> tracks;
+  // crates[i] lists the crates that contain tracks[i], using Serato's names for them
+  // ("Parent%%Child").
+  std::vector<std::vector<std::string>> crates;
+};
+
+// Checks whether each track's file exists. Serato stores paths relative to the root of the volume
+// holding the library, so files are looked up relative to root.
+//
+// Rather than stat every track, tracks are grouped by directory and each directory is listed once,
+// on a pool of threads. Names that aren't in the listing are confirmed with a stat, so that
+// filesystems that ignore case or normalization form don't produce false positives.
+MissingFiles scanMissingFiles(const Library& library, const std::string& root = "/");
@@ -0,0 +1,67 @@
+// This file contains helpers for running work on several threads.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns the number of worker threads to use for count independent tasks.
+inline size_t workerCount(size_t count) {
+  size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  return std::min(count, hardware);
+}
+
+// Calls fn(i) for each i in [0, count), spread over up to workers threads (including the calling
+// thread). Returns once all calls have finished. If any call throws, the remaining unstarted calls
+// are skipped and the first exception is rethrown on the calling thread.
+template<typename F>
+void parallelFor(size_t count, F fn, size_t workers) {
+  workers = std::min(count, workers);
+  if (workers <= 1) {
+    for (size_t i = 0; i < count; i++) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto work = [&]() {
+    for (size_t i = next++; i < count && !failed; i = next++) {
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) {
+          error = std::current_exception();
+          failed = true;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Same as above, with one thread per core. Use the overload above for I/O-bound work.
+template<typename F>
+void parallelFor(size_t count, F fn) {
+  parallelFor(count, fn, workerCount(count));
+}
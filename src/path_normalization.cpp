@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+
+#include "path_normalization.h"
+#include "unicode_tables.h"
+
+namespace {
+
+// Hangul syllables are composed and decomposed algorithmically rather than through the tables;
+// see section 3.12 of the Unicode standard.
+const char32_t kHangulSBase = 0xAC00;
+const char32_t kHangulLBase = 0x1100;
+const char32_t kHangulVBase = 0x1161;
+const char32_t kHangulTBase = 0x11A7;
+const char32_t kHangulLCount = 19;
+const char32_t kHangulVCount = 21;
+const char32_t kHangulTCount = 28;
+const char32_t kHangulNCount = kHangulVCount * kHangulTCount;
+const char32_t kHangulSCount = kHangulLCount * kHangulNCount;
+
+// Codepoints above 0x10FFFF can't occur in valid Unicode, so we use them to carry bytes of
+// invalid UTF-8 through normalization unchanged.
+const char32_t kRawByteBase = 0x110000;
+
+char32_t lowercase(char32_t cp) {
+  if (cp < 0x80) {
+    return cp >= 'A' && cp <= 'Z' ? cp + ('a' - 'A') : cp;
+  }
+  auto it = std::lower_bound(
+      std::begin(kUnicodeLowercase), std::end(kUnicodeLowercase), cp,
+      [](const UnicodeMapping& m, char32_t c) { return m.from < c; });
+  return it != std::end(kUnicodeLowercase) && it->from == cp ? it->to : cp;
+}
+
+uint8_t combiningClass(char32_t cp) {
+  if (cp < 0x300) {
+    return 0;
+  }
+  auto it = std::upper_bound(
+      std::begin(kUnicodeCombiningClasses), std::end(kUnicodeCombiningClasses), cp,
+      [](char32_t c, const UnicodeCombiningClassRange& r) { return c < r.first; });
+  if (it == std::begin(kUnicodeCombiningClasses)) {
+    return 0;
+  }
+  --it;
+  return cp <= it->last ? it->ccc : 0;
+}
+
+void decompose(char32_t cp, std::u32string* out) {
+  if (cp >= kHangulSBase && cp < kHangulSBase + kHangulSCount) {
+    char32_t s_index = cp - kHangulSBase;
+    out->push_back(kHangulLBase + s_index / kHangulNCount);
+    out->push_back(kHangulVBase + (s_index % kHangulNCount) / kHangulTCount);
+    if (s_index % kHangulTCount != 0) {
+      out->push_back(kHangulTBase + s_index % kHangulTCount);
+    }
+    return;
+  }
+  if (cp >= 0xC0 && cp < kRawByteBase) {
+    auto it = std::lower_bound(
+        std::begin(kUnicodeDecompositions), std::end(kUnicodeDecompositions), cp,
+        [](const UnicodeDecomposition& d, char32_t c) { return d.cp < c; });
+    if (it != std::end(kUnicodeDecompositions) && it->cp == cp) {
+      decompose(it->first, out);
+      if (it->second) {
+        decompose(it->second, out);
+      }
+      return;
+    }
+  }
+  out->push_back(cp);
+}
+
+// Returns the primary composite of first and second, or 0 if there isn't one.
+char32_t compose(char32_t first, char32_t second) {
+  if (first >= kHangulLBase && first < kHangulLBase + kHangulLCount
+      && second >= kHangulVBase && second < kHangulVBase + kHangulVCount) {
+    return kHangulSBase
+        + ((first - kHangulLBase) * kHangulVCount + (second - kHangulVBase)) * kHangulTCount;
+  }
+  if (first >= kHangulSBase && first < kHangulSBase + kHangulSCount
+      && (first - kHangulSBase) % kHangulTCount == 0
+      && second > kHangulTBase && second < kHangulTBase + kHangulTCount) {
+    return first + (second - kHangulTBase);
+  }
+  auto it = std::lower_bound(
+      std::begin(kUnicodeCompositions), std::end(kUnicodeCompositions),
+      std::make_pair(first, second),
+      [](const UnicodeComposition& c, const std::pair<char32_t, char32_t>& key) {
+        return c.first != key.first ? c.first < key.first : c.second < key.second;
+      });
+  if (it != std::end(kUnicodeCompositions) && it->first == first && it->second == second) {
+    return it->composite;
+  }
+  return 0;
+}
+
+// Decodes one codepoint starting at path[*pos] and advances *pos past it.
+char32_t decodeUtf8(std::string_view path, size_t* pos) {
+  unsigned char lead = path[*pos];
+  if (lead < 0x80) {
+    (*pos)++;
+    return lead;
+  }
+  size_t len = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  char32_t cp = len == 4 ? lead & 0x07 : len == 3 ? lead & 0x0F : lead & 0x1F;
+  bool valid = lead >= 0xC2 && lead <= 0xF4 && *pos + len <= path.size();
+  for (size_t i = 1; valid && i < len; i++) {
+    unsigned char cont = path[*pos + i];
+    valid = (cont & 0xC0) == 0x80;
+    cp = (cp << 6) | (cont & 0x3F);
+  }
+  if (!valid) {
+    return kRawByteBase + static_cast<unsigned char>(path[(*pos)++]);
+  }
+  *pos += len;
+  return cp;
+}
+
+void encodeUtf8(char32_t cp, std::string* out) {
+  if (cp >= kRawByteBase) {
+    out->push_back(static_cast<char>(cp - kRawByteBase));
+  } else if (cp < 0x80) {
+    out->push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+}  // namespace
+
+std::string normalizePathKey(std::string_view path) {
+  std::string ret(path);
+
+  bool ascii = true;
+  for (char& c : ret) {
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    } else if (static_cast<unsigned char>(c) >= 0x80) {
+      ascii = false;
+    }
+  }
+  if (ascii) {
+    return ret;
+  }
+
+  // Lowercase and fully decompose.
+  std::u32string cps;
+  cps.reserve(path.size());
+  for (size_t pos = 0; pos < path.size();) {
+    decompose(lowercase(decodeUtf8(path, &pos)), &cps);
+  }
+
+  // Put each run of combining marks into canonical order.
+  for (size_t i = 0; i < cps.size();) {
+    if (combiningClass(cps[i]) == 0) {
+      i++;
+      continue;
+    }
+    size_t end = i;
+    while (end < cps.size() && combiningClass(cps[end]) != 0) {
+      end++;
+    }
+    std::stable_sort(cps.begin() + i, cps.begin() + end, [](char32_t a, char32_t b) {
+      return combiningClass(a) < combiningClass(b);
+    });
+    i = end;
+  }
+
+  // Recompose. This is the canonical composition algorithm from UAX #15.
+  size_t starter_pos = 0;
+  int last_class = combiningClass(cps[0]) == 0 ? 0 : 256;
+  size_t comp_pos = 1;
+  for (size_t decomp_pos = 1; decomp_pos < cps.size(); decomp_pos++) {
+    char32_t cp = cps[decomp_pos];
+    int cp_class = combiningClass(cp);
+    char32_t composite = compose(cps[starter_pos], cp);
+    if (composite != 0 && (last_class < cp_class || last_class == 0)) {
+      cps[starter_pos] = composite;
+      continue;
+    }
+    if (cp_class == 0) {
+      starter_pos = comp_pos;
+    }
+    last_class = cp_class;
+    cps[comp_pos++] = cp;
+  }
+  cps.resize(comp_pos);
+
+  ret.clear();
+  for (char32_t cp : cps) {
+    encodeUtf8(cp, &ret);
+  }
+  return ret;
+}
@@ -0,0 +1,14 @@
+// This file contains normalizePathKey, which maps paths that Serato considers the same file (but
+// which may be spelled differently on disk) to the same string.
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Returns a key for path that is the same for paths that differ only in case or in Unicode
+// normalization form (e.g. an NFD path written by macOS and an NFC path written by Windows).
+// The key is path lowercased and converted to NFC. ASCII paths take a fast path that only
+// lowercases; the Unicode tables are only consulted for paths containing non-ASCII bytes.
+//
+// Invalid UTF-8 sequences are passed through byte-for-byte.
+std::string normalizePathKey(std::string_view path);
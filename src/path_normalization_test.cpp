@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "path_normalization.h"
+
+TEST(NormalizePathKeyTest, LowercasesAscii) {
+  EXPECT_EQ(normalizePathKey("Music/Artist/Track.MP3"), "music/artist/track.mp3");
+  EXPECT_EQ(normalizePathKey(""), "");
+}
+
+TEST(NormalizePathKeyTest, DecomposedAndPrecomposedMatch) {
+  // "Café" written by macOS (NFD: e + combining acute) and by Windows (NFC: é).
+  std::string nfd = "Music/Cafe\xcc\x81.mp3";
+  std::string nfc = "Music/Caf\xc3\xa9.mp3";
+  EXPECT_EQ(normalizePathKey(nfd), normalizePathKey(nfc));
+  EXPECT_EQ(normalizePathKey(nfc), "music/caf\xc3\xa9.mp3");
+}
+
+TEST(NormalizePathKeyTest, FoldsNonAsciiCase) {
+  EXPECT_EQ(normalizePathKey("\xc3\x89t\xc3\xa9.mp3"), normalizePathKey("\xc3\xa9t\xc3\xa9.mp3"));
+  // Cyrillic Ж and ж.
+  EXPECT_EQ(normalizePathKey("\xd0\x96"), normalizePathKey("\xd0\xb6"));
+}
+
+TEST(NormalizePathKeyTest, NfdAndUppercaseTogether) {
+  // "É" as E + combining acute, against precomposed lowercase "é".
+  EXPECT_EQ(normalizePathKey("E\xcc\x81"), normalizePathKey("\xc3\xa9"));
+}
+
+TEST(NormalizePathKeyTest, ReordersCombiningMarks) {
+  // a + dot below + dot above, with the marks in either order, is the same canonical string.
+  EXPECT_EQ(normalizePathKey("a\xcc\xa3\xcc\x87"), normalizePathKey("a\xcc\x87\xcc\xa3"));
+}
+
+TEST(NormalizePathKeyTest, ComposesHangul) {
+  // U+1112 U+1161 U+11AB (conjoining jamo) composes to U+D55C.
+  EXPECT_EQ(normalizePathKey("\xe1\x84\x92\xe1\x85\xa1\xe1\x86\xab"), "\xed\x95\x9c");
+}
+
+TEST(NormalizePathKeyTest, KeepsCharactersOutsideTheBmp) {
+  EXPECT_EQ(normalizePathKey("\xf0\x9f\x8e\xb5.mp3"), "\xf0\x9f\x8e\xb5.mp3");
+}
+
+TEST(NormalizePathKeyTest, PassesInvalidUtf8Through) {
+  EXPECT_EQ(normalizePathKey("A\xff\xfe/b"), "a\xff\xfe/b");
+  // A truncated two-byte sequence at the end.
+  EXPECT_EQ(normalizePathKey("x\xc3"), "x\xc3");
+}
@@ -0,0 +1,97 @@
+#include <memory>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf_counters.h"
+
+PerfCounters* PerfCounters::forThisThread() {
+  thread_local bool tried = false;
+  thread_local std::unique_ptr<PerfCounters> counters;
+  if (!tried) {
+    tried = true;
+    std::unique_ptr<PerfCounters> opened(new PerfCounters());
+    if (opened->open()) {
+      counters = std::move(opened);
+    }
+  }
+  return counters.get();
+}
+
+PerfCounters::~PerfCounters() {
+  // Close the group's members before its leader.
+  for (int i = kEvents - 1; i >= 0; i--) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+}
+
+#ifdef __linux__
+
+namespace {
+
+// In the same order as the fields of HardwareCounters.
+const uint64_t kEventConfigs[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+}  // namespace
+
+bool PerfCounters::open() {
+  for (int i = 0; i < kEvents; i++) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = kEventConfigs[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // This thread, any CPU, grouped under the first counter.
+    fds_[i] = syscall(
+        __NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], PERF_FLAG_FD_CLOEXEC);
+    if (fds_[i] < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HardwareCounters PerfCounters::read() const {
+  uint64_t counts[kEvents] = {};
+  for (int i = 0; i < kEvents; i++) {
+    // value, time enabled, time running.
+    uint64_t values[3];
+    if (::read(fds_[i], values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+      continue;
+    }
+    counts[i] = values[2] == values[1]
+        ? values[0]
+        : static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+  }
+  HardwareCounters ret;
+  ret.cycles = counts[0];
+  ret.instructions = counts[1];
+  ret.cache_misses = counts[2];
+  ret.branch_misses = counts[3];
+  return ret;
+}
+
+#else  // __linux__
+
+bool PerfCounters::open() {
+  return false;
+}
+
+HardwareCounters PerfCounters::read() const {
+  return HardwareCounters();
+}
+
+#endif  // __linux__
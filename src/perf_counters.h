@@ -0,0 +1,53 @@
+// This file contains PerfCounters, which reads hardware event counters with perf_event_open(2).
+#pragma once
+
+#include "seratocrates.h"
+
+// Adds counts to *into.
+inline void addCounters(HardwareCounters* into, const HardwareCounters& counts) {
+  into->cycles += counts.cycles;
+  into->instructions += counts.instructions;
+  into->cache_misses += counts.cache_misses;
+  into->branch_misses += counts.branch_misses;
+}
+
+// Returns end - start, for two readings of the same PerfCounters.
+inline HardwareCounters countersSince(const HardwareCounters& start, const HardwareCounters& end) {
+  HardwareCounters ret;
+  ret.cycles = end.cycles - start.cycles;
+  ret.instructions = end.instructions - start.instructions;
+  ret.cache_misses = end.cache_misses - start.cache_misses;
+  ret.branch_misses = end.branch_misses - start.branch_misses;
+  return ret;
+}
+
+// Counts the events in HardwareCounters for one thread, in user space only. The counters are
+// inherited by threads that it starts after they're opened, and a started thread's counts are
+// added in when it exits, so a reading taken after joining a parallelFor includes its workers.
+//
+// The four counters are opened as one group so that the kernel always schedules them together. If
+// the kernel has to multiplex them with other users of the PMU, the counts are scaled up by the
+// fraction of time they were actually running.
+class PerfCounters {
+public:
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Returns the calling thread's counters, opening them on first use. Returns null if they can't be
+  // opened (not Linux, not permitted, or no hardware counters, as in many VMs); the failure is
+  // remembered, so later calls on the thread are cheap.
+  static PerfCounters* forThisThread();
+
+  // Returns the counts so far. Only meaningful as the difference between two readings.
+  HardwareCounters read() const;
+
+private:
+  PerfCounters() = default;
+
+  bool open();
+
+  static const int kEvents = 4;
+  int fds_[kEvents] = {-1, -1, -1, -1};
+};
@@ -1,13 +1,17 @@
 // This file contains code to read and parse the raw "database V2" and *.crate files from disk.
 #pragma once
 
+#include <algorithm>
 #include <codecvt>
-#include <cstdio>
 #include <locale>
 #include <map>
+#include <optional>
 
 #include "seratocrates.h"
+#include "batch_read.h"
 #include "memberpointer.h"
+#include "parallel.h"
+#include "tracer.h"
 
 // Serato .crate files each encode exactly one root Crate object. Each Crate object contains
 // several fields. Each field may be a primitive datatype or an object. Each field may be
@@ -17,8 +21,10 @@
 //
 // This file starts with some forward declarations. Then, we define templated read<T>() and
 // read_repeated<T>() functions for reading objects from .crate files, along with specializations
-// of read<T>() for primitive datatypes. Finally, we specify kFields for each object type. kFields
-// describes the object's fields and how to read them.
+// of read<T>() for primitive datatypes. Then, we specify kFields for each object type. kFields
+// describes the object's fields and how to read them. Finally, we specialize read<DatabaseFile>()
+// so that large databases are parsed on several threads, and define forEachDatabaseTrack for
+// callers that want to stream tracks rather than collect them.
 //
 // For more information, including the specifics of the on-disk format, see
 // https://www.mixxx.org/wiki/doku.php/serato_database_format
@@ -58,10 +64,41 @@ struct DatabaseFile {
 
 // Next, other structs and declarations we need.
 
+// The bytes being parsed. Files are read into memory in one go and then parsed from there.
 struct ReadContext {
-  FILE *file;
+  const char* data;
+  size_t size;
+  size_t pos;
+  // Counters are only updated if this isn't null. See ReadOptions::stats.
+  LoadStats* stats;
+
+  // If not null, progress is published (and cancellation checked) every kProgressInterval
+  // records. See ReadOptions::progress.
+  LoadProgress* progress = nullptr;
+  size_t records_until_progress = 0;
+  // How far into data has been added to progress->bytes_done.
+  size_t reported_pos = 0;
+
+  // See ReadOptions::tracer.
+  Tracer* tracer = nullptr;
 };
 
+const size_t kProgressInterval = 4096;
+
+// Adds the bytes parsed since the last call to ctx->progress, and throws LoadCancelled if the load
+// has been cancelled.
+inline void reportProgress(ReadContext* ctx) {
+  ctx->records_until_progress = kProgressInterval;
+  if (ctx->pos > ctx->reported_pos) {
+    ctx->progress->bytes_done += ctx->pos - ctx->reported_pos;
+    ctx->reported_pos = ctx->pos;
+  }
+  if (ctx->progress->cancel) {
+    throw LoadCancelled("Load was cancelled");
+  }
+}
+
+
 typedef void (*ReadFunc)(ReadContext* ctx, size_t bytes, void* obj);
 
 struct Field {
@@ -77,80 +114,123 @@ const std::map<std::string, Field> kFields;
 const size_t kTagSize = 4;
 const size_t kRecordSizeSize = 4;
 
-// We take a void* rather than a T* so that all read<T> instantiations have the same signature,
-// which allows them to be placed in the same container.
+// Reads the tag and size that start each record, leaving ctx positioned at the record's payload.
+inline void readRecordHeader(ReadContext* ctx, std::string* tag, size_t* record_size) {
+  if (ctx->progress && ctx->records_until_progress-- == 0) {
+    reportProgress(ctx);
+  }
+  if (ctx->size - ctx->pos < kTagSize) {
+    throw ReadException(
+        "File was truncated when reading tag (at offset " + std::to_string(ctx->pos) + ")!");
+  }
+  tag->assign(ctx->data + ctx->pos, kTagSize);
+  ctx->pos += kTagSize;
+
+  // Read size. It's stored as a big-endian 4-byte unsigned int.
+  if (ctx->size - ctx->pos < kRecordSizeSize) {
+    throw ReadException(
+        "File was truncated when reading field size (at offset " + std::to_string(ctx->pos)
+        + ")!");
+  }
+  *record_size = 0;
+  for (size_t i = 0; i < kRecordSizeSize; i++) {
+    *record_size <<= 8;
+    *record_size += static_cast<unsigned char>(ctx->data[ctx->pos++]);
+  }
+
+  if (ctx->stats) {
+    ctx->stats->records_visited++;
+  }
+}
+
+// Skips over a record's payload. Skipping past the end of the data isn't an error by itself; if
+// anything needs to be read after it, that read will fail.
+inline void skipRecord(ReadContext* ctx, size_t record_size) {
+  ctx->pos += std::min(record_size, ctx->size - ctx->pos);
+}
+
+// Reads the record whose header has just been read into the matching field of obj, or skips it if
+// T has no such field.
 template<typename T>
-void read(ReadContext* ctx, const size_t bytes, void* obj_void) {
-  T* obj = static_cast<T*>(obj_void);
-  size_t bytes_read = 0;
-  while (bytes_read < bytes) {
-    // Read tag.
-    std::string tag(kTagSize, '\0');
-    if (kTagSize != fread(tag.data(), 1, kTagSize, ctx->file)) {
-      throw ReadException(
-          "File was truncated when reading tag (at offset "
-          + std::to_string(ftell(ctx->file)) + ")!");
+void readField(ReadContext* ctx, const std::string& tag, size_t record_size, T* obj) {
+  auto it = kFields<T>.find(tag);
+  if (it == kFields<T>.end()) {
+    // Field is not supported, silently ignore it.
+    skipRecord(ctx, record_size);
+    if (ctx->stats) {
+      ctx->stats->unknown_tags_skipped++;
     }
-    bytes_read += kTagSize;
+    return;
+  }
+  const Field& field = it->second;
+  void* member = &(obj->*static_cast<char T::*>(MemberPointer(field.member)));
+  field.readfunc(ctx, record_size, member);
+}
 
-    // Read size. It's stored as a big-endian 4-byte unsigned int.
+// Reads the next bytes bytes of records into the fields of obj.
+template<typename T>
+void readFields(ReadContext* ctx, const size_t bytes, T* obj) {
+  size_t bytes_read = 0;
+  std::string tag;
+  while (bytes_read < bytes) {
     size_t record_size = 0;
-    for (size_t i = 0; i < kRecordSizeSize; i++) {
-      int byte = fgetc(ctx->file);
-      if (byte == EOF) {
-        throw ReadException(
-            "File was truncated when reading field size (at offset "
-            + std::to_string(ftell(ctx->file)) + ")!");
-      }
-      record_size <<= 8;
-      record_size += byte;
-    }
-    bytes_read += kRecordSizeSize;
-    bytes_read += record_size;
-
-    if (!kFields<T>.count(tag)) {
-      // Field is not supported, silently ignore it.
-      fseek(ctx->file, record_size, SEEK_CUR);
-      continue;
-    }
-    Field field = kFields<T>.at(tag);
-    void* member = &(obj->*static_cast<char T::*>(field.member));
-    field.readfunc(ctx, record_size, member);
+    readRecordHeader(ctx, &tag, &record_size);
+    bytes_read += kTagSize + kRecordSizeSize + record_size;
+    readField(ctx, tag, record_size, obj);
   }
 }
 
+// We take a void* rather than a T* so that all read<T> instantiations have the same signature,
+// which allows them to be placed in the same container.
+template<typename T>
+void read(ReadContext* ctx, const size_t bytes, void* obj_void) {
+  readFields(ctx, bytes, static_cast<T*>(obj_void));
+}
+
 // Next, specializations of read<T>() for primitive datatypes.
 template<>
-void read<std::string>(ReadContext* ctx, const size_t bytes, void* str_void) {
+inline void read<std::string>(ReadContext* ctx, const size_t bytes, void* str_void) {
   std::string* str = static_cast<std::string*>(str_void);
-  std::u16string utf16_string;
+  if (ctx->size - ctx->pos < bytes) {
+    throw ReadException("Crate file was truncated when reading string");
+  }
 
+  std::u16string utf16_string(bytes / 2, u'\0');
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(ctx->data + ctx->pos);
   for (size_t i = 0; i < bytes / 2; i++) {
-    char16_t c = 0;
-    int b = fgetc(ctx->file);
-    if (b == EOF) {
-      throw ReadException("Crate file was truncated when reading string");
-    }
-    c |= b << 8;
-
-    b = fgetc(ctx->file);
-    if (b == EOF) {
-      throw ReadException("Crate file was truncated when reading string");
-    }
-    c |= b;
-    utf16_string += c;
+    utf16_string[i] = static_cast<char16_t>(in[2 * i] << 8 | in[2 * i + 1]);
+  }
+  ctx->pos += bytes;
+  if (ctx->stats && bytes > 0) {
+    ctx->stats->allocations++;
   }
 
   *str = std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>{}.to_bytes(utf16_string);
 }
 
+template<>
+inline void read<uint32_t>(ReadContext* ctx, const size_t bytes, void* int_void) {
+  uint32_t* value = static_cast<uint32_t*>(int_void);
+  if (bytes != sizeof(uint32_t) || ctx->size - ctx->pos < bytes) {
+    throw ReadException(
+        "Bad or truncated uint32 field (at offset " + std::to_string(ctx->pos) + ")!");
+  }
+  *value = 0;
+  for (size_t i = 0; i < sizeof(uint32_t); i++) {
+    *value = *value << 8 | static_cast<unsigned char>(ctx->data[ctx->pos++]);
+  }
+}
+
 // Next, specialization of read<T> for shared_ptr<Track>
 // TODO It would be nice if I could write this generically for any shared_ptr<T>, but I think C++
 // makes that hard.
 template<>
-void read<std::shared_ptr<Track>>(ReadContext* ctx, const size_t bytes, void* shared_ptr_void) {
+inline void read<std::shared_ptr<Track>>(ReadContext* ctx, const size_t bytes, void* shared_ptr_void) {
   std::shared_ptr<Track>& sp = *static_cast<std::shared_ptr<Track>*>(shared_ptr_void);
   sp = std::make_shared<Track>();
+  if (ctx->stats) {
+    ctx->stats->allocations++;
+  }
   read<Track>(ctx, bytes, sp.get());
 }
 
@@ -165,32 +245,76 @@ void read_repeated(ReadContext* ctx, const size_t bytes, void* obj_vec_void) {
   read<T>(ctx, bytes, obj);
 }
 
-// Next, definition of read_from_path which reads a whole file (DatabaseFile or CrateFile) and
-// returns it as a unique_ptr.
+// Next, definitions of parseFile and readFromPath, which parse a whole file (DatabaseFile or
+// CrateFile) from memory or from disk respectively and return it as a unique_ptr.
+//
+// parseFile doesn't add to options.progress->bytes_total; callers do that once they know which
+// files they'll parse. readFromPath does, since it reads the file itself.
+inline ReadContext makeReadContext(const std::string& data, const ReadOptions& options) {
+  ReadContext ret{data.data(), data.size(), 0, options.stats};
+  ret.progress = options.progress;
+  ret.tracer = options.tracer;
+  if (options.stats) {
+    options.stats->bytes_read += data.size();
+  }
+  return ret;
+}
+
 template<typename T>
-std::unique_ptr<T> readFromPath(const std::string& path) {
+std::unique_ptr<T> parseFile(const std::string& data, const ReadOptions& options = ReadOptions()) {
   std::unique_ptr<T> ret = std::make_unique<T>();
-
-  ReadContext ctx{};
-  ctx.file = fopen(path.c_str(), "r");
-  if (ctx.file == nullptr) {
-    throw ReadException("Could not open file at path " + path);
+  ReadContext ctx = makeReadContext(data, options);
+  read<T>(&ctx, data.size(), ret.get());
+  if (ctx.progress) {
+    reportProgress(&ctx);
   }
+  return ret;
+}
 
-  fseek(ctx.file, 0, SEEK_END);
-  size_t len = ftell(ctx.file);
-  fseek(ctx.file, 0, SEEK_SET);
-
-  // TODO need to clean up fin if this throws.
-  read<T>(&ctx, len, ret.get());
-
-  fclose(ctx.file);
+// Parses data, which was read from path when the file was at version. readFile catches files that
+// change during the read, but not a read that lands while the writer is paused between writes,
+// which sees a file that's cut short but not changing. So if parsing fails and the file has
+// changed since, it's read and parsed again (counted in LoadStats::torn_read_retries).
+template<typename T>
+std::unique_ptr<T> parseReadFile(
+    const std::string& path, const std::string& data, FileVersion version,
+    const ReadOptions& options) {
+  const std::string* contents = &data;
+  std::string reread;
+  for (int attempt = 1; ; attempt++) {
+    try {
+      TraceSpan span(options.tracer, "parse", path);
+      return parseFile<T>(*contents, options);
+    } catch (const LoadCancelled&) {
+      throw;
+    } catch (const ReadException&) {
+      if (attempt == kMaxReadAttempts || fileVersion(path) == version) {
+        throw;
+      }
+    }
+    if (options.stats) {
+      options.stats->torn_read_retries++;
+    }
+    reread = readFile(path, options, &version);
+    if (options.progress) {
+      options.progress->bytes_total += reread.size();
+    }
+    contents = &reread;
+  }
+}
 
-  return ret;
+template<typename T>
+std::unique_ptr<T> readFromPath(const std::string& path, const ReadOptions& options = ReadOptions()) {
+  FileVersion version;
+  std::string data = readFile(path, options, &version);
+  if (options.progress) {
+    options.progress->bytes_total += data.size();
+  }
+  return parseReadFile<T>(path, data, version, options);
 }
 
-// Finally, the rest of this file gives kFields for each object type. kFields specifies what
-// fields the type has and how they should be read from disk.
+// Next, kFields for each object type. kFields specifies what fields the type has and how they
+// should be read from disk.
 
 // Note: make sure that the readfunc you specify matches the type of the member! In particular,
 // you must use read_repeated iff the member is a std::vector. Otherwise you'll get weird crashes
@@ -198,6 +322,14 @@ std::unique_ptr<T> readFromPath(const std::string& path) {
 template<>
 const std::map<std::string, Field> kFields<Track> = {
   {"pfil", Field{.member = &Track::path, .readfunc = read<std::string>}},
+  {"tsng", Field{.member = &Track::title, .readfunc = read<std::string>}},
+  {"tart", Field{.member = &Track::artist, .readfunc = read<std::string>}},
+  {"talb", Field{.member = &Track::album, .readfunc = read<std::string>}},
+  {"tcom", Field{.member = &Track::comment, .readfunc = read<std::string>}},
+  {"tbpm", Field{.member = &Track::bpm, .readfunc = read<std::string>}},
+  {"tkey", Field{.member = &Track::key, .readfunc = read<std::string>}},
+  {"tlen", Field{.member = &Track::length, .readfunc = read<std::string>}},
+  {"uadd", Field{.member = &Track::date_added, .readfunc = read<uint32_t>}},
 };
 
 
@@ -217,3 +349,126 @@ const std::map<std::string, Field> kFields<DatabaseFile> = {
   {"vrsn", Field{.member = &DatabaseFile::version, .readfunc = read<std::string>}},
   {"otrk", Field{.member = &DatabaseFile::tracks, .readfunc = read_repeated<std::shared_ptr<Track>>}},
 };
+
+// Next, read<DatabaseFile>. A database holds one otrk record per track, and those records don't
+// depend on each other, so large databases are parsed in two phases. First, a quick pass hops
+// from record header to record header to find where each otrk record starts. Then worker threads
+// each decode a contiguous chunk of those records into their own track list, and the lists are
+// concatenated in order.
+
+// Databases smaller than this are parsed on the calling thread.
+const size_t kParallelParseMinBytes = 1 << 20;
+// Each worker thread gets about this many chunks, so that a slow chunk doesn't hold up the rest.
+const size_t kChunksPerWorker = 4;
+
+template<>
+inline void read<DatabaseFile>(ReadContext* ctx, const size_t bytes, void* obj_void) {
+  DatabaseFile* obj = static_cast<DatabaseFile*>(obj_void);
+  size_t workers = workerCount(SIZE_MAX);
+  if (bytes < kParallelParseMinBytes || workers <= 1) {
+    readFields(ctx, bytes, obj);
+    return;
+  }
+
+  // Phase one: find the otrk records. Other fields are cheap and are read as we go.
+  struct Span {
+    size_t pos;
+    size_t size;
+  };
+  std::vector<Span> track_spans;
+  size_t bytes_read = 0;
+  std::string tag;
+  // The quick pass doesn't report progress: the bytes are counted as the workers decode them.
+  // It does check for cancellation now and then.
+  LoadProgress* progress = ctx->progress;
+  ctx->progress = nullptr;
+  std::optional<TraceSpan> scan_span(std::in_place, ctx->tracer, "find tracks");
+  while (bytes_read < bytes) {
+    if (track_spans.size() % kProgressInterval == 0) {
+      checkCancelled(progress);
+    }
+    size_t record_size = 0;
+    readRecordHeader(ctx, &tag, &record_size);
+    bytes_read += kTagSize + kRecordSizeSize + record_size;
+    if (tag == "otrk") {
+      track_spans.push_back(Span{ctx->pos, record_size});
+      skipRecord(ctx, record_size);
+    } else {
+      readField(ctx, tag, record_size, obj);
+    }
+  }
+  scan_span.reset();
+
+  // Phase two: decode chunks of otrk records in parallel.
+  // Each chunk counts into its own LoadStats so that workers don't contend on the counters.
+  size_t chunk_count = std::min(track_spans.size(), workers * kChunksPerWorker);
+  std::vector<std::vector<std::shared_ptr<Track>>> chunk_tracks(chunk_count);
+  std::vector<LoadStats> chunk_stats(ctx->stats ? chunk_count : 0);
+  std::vector<size_t> chunk_reported(chunk_count);
+  parallelFor(chunk_count, [&](size_t chunk) {
+    size_t begin = track_spans.size() * chunk / chunk_count;
+    size_t end = track_spans.size() * (chunk + 1) / chunk_count;
+    std::string detail;
+    if (ctx->tracer) {
+      detail = "tracks " + std::to_string(begin) + " to " + std::to_string(end);
+    }
+    TraceSpan span(ctx->tracer, "decode tracks", detail);
+    std::vector<std::shared_ptr<Track>>& tracks = chunk_tracks[chunk];
+    tracks.reserve(end - begin);
+    ReadContext chunk_ctx = *ctx;
+    chunk_ctx.stats = ctx->stats ? &chunk_stats[chunk] : nullptr;
+    chunk_ctx.progress = progress;
+    chunk_ctx.reported_pos = track_spans[begin].pos;
+    for (size_t i = begin; i < end; i++) {
+      chunk_ctx.pos = track_spans[i].pos;
+      read<std::shared_ptr<Track>>(&chunk_ctx, track_spans[i].size, &tracks.emplace_back());
+    }
+    if (progress) {
+      reportProgress(&chunk_ctx);
+    }
+    chunk_reported[chunk] = chunk_ctx.reported_pos - track_spans[begin].pos;
+  });
+
+  // Count whatever the workers didn't (record headers and non-track records) as done too.
+  ctx->progress = progress;
+  for (size_t reported : chunk_reported) {
+    ctx->reported_pos += reported;
+  }
+
+  for (const LoadStats& stats : chunk_stats) {
+    ctx->stats->records_visited += stats.records_visited;
+    ctx->stats->unknown_tags_skipped += stats.unknown_tags_skipped;
+    ctx->stats->allocations += stats.allocations;
+  }
+
+  obj->tracks.reserve(obj->tracks.size() + track_spans.size());
+  for (std::vector<std::shared_ptr<Track>>& tracks : chunk_tracks) {
+    obj->tracks.insert(obj->tracks.end(), tracks.begin(), tracks.end());
+  }
+}
+
+// Last of all, forEachDatabaseTrack. It's the same as parseFile<DatabaseFile>, but rather than
+// collecting the tracks it calls on_track(track) for each one as soon as it's decoded. The track
+// is only valid during the call. Returns the database's version.
+template<typename F>
+std::string forEachDatabaseTrack(const std::string& data, const ReadOptions& options, F on_track) {
+  DatabaseFile database;
+  ReadContext ctx = makeReadContext(data, options);
+  Track track;
+  std::string tag;
+  while (ctx.pos < ctx.size) {
+    size_t record_size = 0;
+    readRecordHeader(&ctx, &tag, &record_size);
+    if (tag != "otrk") {
+      readField(&ctx, tag, record_size, &database);
+      continue;
+    }
+    track = Track();
+    read<Track>(&ctx, record_size, &track);
+    on_track(static_cast<const Track&>(track));
+  }
+  if (ctx.progress) {
+    reportProgress(&ctx);
+  }
+  return database.version;
+}
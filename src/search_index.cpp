@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "path_normalization.h"
+#include "search_index.h"
+#include "track_index.h"
+
+namespace {
+
+// Separates fields in a document's text. N-grams that contain it aren't indexed, and it can't
+// occur in a query, so matches never span fields.
+const char kFieldSeparator = '\x1f';
+
+// Once more than this fraction of documents are stale, update() rebuilds the index from scratch.
+const double kMaxStaleFraction = 0.5;
+
+// Trigrams are keyed by their three bytes. Bigrams (which we index so that two-byte queries, such
+// as a single accented letter, don't need a scan) set a bit above those.
+const uint32_t kBigramFlag = 1 << 24;
+
+uint32_t trigramAt(std::string_view text, size_t pos) {
+  return static_cast<uint32_t>(static_cast<unsigned char>(text[pos])) << 16
+      | static_cast<uint32_t>(static_cast<unsigned char>(text[pos + 1])) << 8
+      | static_cast<uint32_t>(static_cast<unsigned char>(text[pos + 2]));
+}
+
+uint32_t bigramAt(std::string_view text, size_t pos) {
+  return kBigramFlag
+      | static_cast<uint32_t>(static_cast<unsigned char>(text[pos])) << 8
+      | static_cast<uint32_t>(static_cast<unsigned char>(text[pos + 1]));
+}
+
+bool isWordStart(std::string_view text, size_t pos) {
+  if (pos == 0) {
+    return true;
+  }
+  char c = text[pos - 1];
+  return c == kFieldSeparator || c == ' ' || c == '/' || c == '-' || c == '_' || c == '('
+      || c == '[';
+}
+
+// The text we index for a track: each field folded with normalizePathKey, joined by
+// kFieldSeparator.
+std::string documentText(const Track& track) {
+  std::string ret = normalizePathKey(track.path);
+  for (const std::string* field : {&track.title, &track.artist, &track.album, &track.comment}) {
+    ret += kFieldSeparator;
+    ret += normalizePathKey(*field);
+  }
+  return ret;
+}
+
+// Writes the elements common to small and large (both sorted) to out. small should be the shorter
+// of the two.
+void intersect(const std::vector<uint32_t>& small, const std::vector<uint32_t>& large,
+               std::vector<uint32_t>* out) {
+  out->clear();
+  size_t i = 0;
+  size_t j = 0;
+#ifdef __SSE2__
+  // For each element of small, skip through large four elements at a time until we reach the
+  // block that could contain it, then compare against the whole block at once. Once fewer than
+  // four elements of large are left, finish with the plain merge below.
+  for (; i < small.size(); i++) {
+    uint32_t x = small[i];
+    while (j + 4 <= large.size() && large[j + 3] < x) {
+      j += 4;
+    }
+    if (j + 4 > large.size()) {
+      break;
+    }
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&large[j]));
+    __m128i eq = _mm_cmpeq_epi32(block, _mm_set1_epi32(static_cast<int>(x)));
+    if (_mm_movemask_epi8(eq) != 0) {
+      out->push_back(x);
+    }
+  }
+#endif
+  while (i < small.size() && j < large.size()) {
+    if (small[i] < large[j]) {
+      i++;
+    } else if (large[j] < small[i]) {
+      j++;
+    } else {
+      out->push_back(small[i]);
+      i++;
+      j++;
+    }
+  }
+}
+
+}  // namespace
+
+
+struct SearchIndex::Impl {
+  struct Document {
+    std::string text;
+    uint64_t fingerprint;
+    size_t track_pos;
+    bool live;
+  };
+
+  std::vector<Document> documents;
+  size_t stale_documents = 0;
+  std::unordered_map<std::string, uint32_t> path_to_document;
+  // Sorted document ids for each trigram. Ids only ever grow, so appending keeps them sorted.
+  std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+
+  void clear() {
+    documents.clear();
+    stale_documents = 0;
+    path_to_document.clear();
+    postings.clear();
+  }
+
+  void add(const Track& track, size_t track_pos) {
+    uint32_t id = documents.size();
+    std::string text = documentText(track);
+    uint64_t fingerprint = hashPath(text);
+    for (size_t pos = 0; pos + 2 <= text.size(); pos++) {
+      if (text[pos] == kFieldSeparator || text[pos + 1] == kFieldSeparator) {
+        continue;
+      }
+      addPosting(bigramAt(text, pos), id);
+      if (pos + 3 <= text.size() && text[pos + 2] != kFieldSeparator) {
+        addPosting(trigramAt(text, pos), id);
+      }
+    }
+    documents.push_back(Document{std::move(text), fingerprint, track_pos, true});
+    // If the path is listed more than once, the last copy wins, as in TrackIndex.
+    auto inserted = path_to_document.emplace(track.path, id);
+    if (!inserted.second) {
+      if (documents[inserted.first->second].live) {
+        remove(inserted.first->second);
+      }
+      inserted.first->second = id;
+    }
+  }
+
+  void addPosting(uint32_t gram, uint32_t id) {
+    std::vector<uint32_t>& posting = postings[gram];
+    // An n-gram can occur more than once in a document.
+    if (posting.empty() || posting.back() != id) {
+      posting.push_back(id);
+    }
+  }
+
+  void remove(uint32_t id) {
+    // Stale documents stay in the posting lists and are skipped at query time.
+    documents[id].live = false;
+    stale_documents++;
+  }
+
+  void build(const Library& library) {
+    clear();
+    documents.reserve(library.tracks.size());
+    for (size_t i = 0; i < library.tracks.size(); i++) {
+      add(*library.tracks[i], i);
+    }
+  }
+
+  // Returns the live documents that might contain query: all documents containing all of its
+  // trigrams (or its bigram, for two-byte queries), or every live document for shorter queries.
+  std::vector<uint32_t> candidates(std::string_view query) const {
+    std::vector<uint32_t> ret;
+    if (query.size() < 2) {
+      for (uint32_t id = 0; id < documents.size(); id++) {
+        if (documents[id].live) {
+          ret.push_back(id);
+        }
+      }
+      return ret;
+    }
+
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (size_t pos = 0; pos + 3 <= std::max<size_t>(query.size(), 3); pos++) {
+      auto it = postings.find(query.size() == 2 ? bigramAt(query, pos) : trigramAt(query, pos));
+      if (it == postings.end()) {
+        return ret;
+      }
+      lists.push_back(&it->second);
+    }
+    // Intersect the shortest lists first so that the intermediate results stay small.
+    std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) {
+      return a->size() < b->size();
+    });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    ret = *lists[0];
+    std::vector<uint32_t> next;
+    for (size_t i = 1; i < lists.size() && !ret.empty(); i++) {
+      intersect(ret, *lists[i], &next);
+      ret.swap(next);
+    }
+    ret.erase(std::remove_if(ret.begin(), ret.end(), [&](uint32_t id) {
+      return !documents[id].live;
+    }), ret.end());
+    return ret;
+  }
+
+  std::vector<size_t> search(const std::string& raw_query, bool prefix) const {
+    std::string query = normalizePathKey(raw_query);
+    std::vector<size_t> ret;
+    // Posting lists are exact for queries that are a single bigram or trigram, so those candidates
+    // only need checking when we care where the match is.
+    bool exact = !prefix && (query.size() == 2 || query.size() == 3);
+    for (uint32_t id : candidates(query)) {
+      if (exact) {
+        ret.push_back(documents[id].track_pos);
+        continue;
+      }
+      std::string_view text = documents[id].text;
+      for (size_t pos = text.find(query); pos != std::string_view::npos;
+           pos = text.find(query, pos + 1)) {
+        if (!prefix || isWordStart(text, pos)) {
+          ret.push_back(documents[id].track_pos);
+          break;
+        }
+      }
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  }
+};
+
+
+SearchIndex::SearchIndex(const Library& library) : impl_(new Impl) {
+  impl_->build(library);
+}
+
+SearchIndex::~SearchIndex() = default;
+
+void SearchIndex::update(const Library& library) {
+  // seen[id] is set for documents that are still in the library. It grows with the documents
+  // added below, because a path listed twice finds its first copy's document.
+  std::vector<bool> seen(impl_->documents.size());
+  for (size_t i = 0; i < library.tracks.size(); i++) {
+    const Track& track = *library.tracks[i];
+    auto it = impl_->path_to_document.find(track.path);
+    if (it != impl_->path_to_document.end()) {
+      Impl::Document& document = impl_->documents[it->second];
+      if (document.fingerprint == hashPath(documentText(track))) {
+        document.track_pos = i;
+        seen[it->second] = true;
+        continue;
+      }
+    }
+    // Replaces the old document, if there is one.
+    impl_->add(track, i);
+    seen.push_back(true);
+  }
+
+  // Anything we didn't see has been removed from the library.
+  for (uint32_t id = 0; id < seen.size(); id++) {
+    if (!seen[id] && impl_->documents[id].live) {
+      impl_->remove(id);
+    }
+  }
+  for (auto it = impl_->path_to_document.begin(); it != impl_->path_to_document.end();) {
+    if (impl_->documents[it->second].live) {
+      ++it;
+    } else {
+      it = impl_->path_to_document.erase(it);
+    }
+  }
+
+  if (impl_->stale_documents > impl_->documents.size() * kMaxStaleFraction) {
+    impl_->build(library);
+  }
+}
+
+std::vector<size_t> SearchIndex::find(const std::string& query) const {
+  return impl_->search(query, false);
+}
+
+std::vector<size_t> SearchIndex::findPrefix(const std::string& query) const {
+  return impl_->search(query, true);
+}
@@ -0,0 +1,38 @@
+// This file contains SearchIndex, for finding tracks by text.
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+// SearchIndex is an in-memory trigram index over the path, title, artist, album and comment of
+// each track in a Library. Matching ignores case and Unicode normalization form. If a path is
+// listed more than once, only its last copy is indexed (as in the lookups readLibrary does).
+//
+// Queries of three or more bytes look up the posting list of each trigram in the query,
+// intersect them, and then check each remaining candidate. Two-byte queries use a bigram posting
+// list, and single-byte queries scan every track.
+class SearchIndex {
+public:
+  explicit SearchIndex(const Library& library);
+  ~SearchIndex();
+
+  // Brings the index up to date with library, which is usually a reload of the library the index
+  // was built from. Tracks are matched up by path, and only tracks that were added, removed or
+  // changed are re-indexed.
+  void update(const Library& library);
+
+  // Returns the positions in Library::tracks (of the library most recently passed to the
+  // constructor or update) of tracks with a field that contains query, in ascending order.
+  std::vector<size_t> find(const std::string& query) const;
+
+  // Same as find, but only matches query at the start of a word: the start of a field, or after a
+  // space, '/', '-', '_', '(' or '['.
+  std::vector<size_t> findPrefix(const std::string& query) const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include "search_index.h"
+
+namespace {
+
+typedef std::vector<size_t> Positions;
+
+std::shared_ptr<Track> makeTrack(const std::string& path, const std::string& title = "",
+                                 const std::string& artist = "") {
+  auto track = std::make_shared<Track>();
+  track->path = path;
+  track->title = title;
+  track->artist = artist;
+  return track;
+}
+
+Library makeLibrary(const std::vector<std::shared_ptr<Track>>& tracks) {
+  Library library;
+  library.tracks = tracks;
+  return library;
+}
+
+Library sampleLibrary() {
+  return makeLibrary({
+      makeTrack("Music/one.mp3", "Blue Monday", "New Order"),
+      makeTrack("Music/two.mp3", "Caf\xc3\xa9 del Mar", "Energy 52"),
+      makeTrack("Music/three.mp3", "Windowlicker", "Aphex Twin"),
+      makeTrack("Music/four.mp3", "Xtal", "Aphex Twin"),
+  });
+}
+
+}  // namespace
+
+TEST(SearchIndexTest, FindsSubstringsOfAnyLength) {
+  SearchIndex index(sampleLibrary());
+  EXPECT_EQ(index.find("aphex twin"), Positions({2, 3}));
+  EXPECT_EQ(index.find("ORDER"), Positions({0}));
+  EXPECT_EQ(index.find("dow"), Positions({2}));
+  EXPECT_EQ(index.find("52"), Positions({1}));
+  EXPECT_EQ(index.find("x"), Positions({2, 3}));
+  EXPECT_EQ(index.find(""), Positions({0, 1, 2, 3}));
+  EXPECT_EQ(index.find("music/"), Positions({0, 1, 2, 3}));
+  EXPECT_TRUE(index.find("techno").empty());
+}
+
+TEST(SearchIndexTest, IgnoresNormalizationForm) {
+  SearchIndex index(sampleLibrary());
+  EXPECT_EQ(index.find("cafe\xcc\x81"), Positions({1}));
+  EXPECT_EQ(index.find("CAF\xc3\x89"), Positions({1}));
+  EXPECT_EQ(index.find("\xc3\xa9"), Positions({1}));
+}
+
+TEST(SearchIndexTest, MatchesDontSpanFields) {
+  SearchIndex index(sampleLibrary());
+  // The end of a title and the start of its artist.
+  EXPECT_TRUE(index.find("mondaynew").empty());
+  EXPECT_TRUE(index.find("mp3blue").empty());
+}
+
+TEST(SearchIndexTest, FindPrefixMatchesWordStarts) {
+  SearchIndex index(sampleLibrary());
+  EXPECT_EQ(index.findPrefix("mon"), Positions({0}));
+  EXPECT_TRUE(index.findPrefix("onday").empty());
+  EXPECT_EQ(index.findPrefix("one"), Positions({0}));
+  EXPECT_EQ(index.findPrefix("twin"), Positions({2, 3}));
+  EXPECT_EQ(index.findPrefix("del"), Positions({1}));
+  EXPECT_TRUE(index.findPrefix("in").empty());
+}
+
+TEST(SearchIndexTest, UpdateReindexesChangedTracks) {
+  Library before = sampleLibrary();
+  SearchIndex index(before);
+
+  // Reordered, "two" removed, "four" retitled and "five" added.
+  Library after = makeLibrary({
+      before.tracks[3],
+      makeTrack("Music/five.mp3", "Xtal", "Other"),
+      before.tracks[2],
+      before.tracks[0],
+  });
+  after.tracks[0] = makeTrack("Music/four.mp3", "Tha", "Aphex Twin");
+  index.update(after);
+
+  EXPECT_EQ(index.find("aphex"), Positions({0, 2}));
+  EXPECT_EQ(index.find("xtal"), Positions({1}));
+  EXPECT_EQ(index.find("blue"), Positions({3}));
+  EXPECT_TRUE(index.find("del mar").empty());
+  EXPECT_EQ(index.find("tha"), Positions({0}));
+  EXPECT_EQ(index.find("music"), Positions({0, 1, 2, 3}));
+}
+
+TEST(SearchIndexTest, UpdateRebuildsOnceMostDocumentsAreStale) {
+  SearchIndex index(sampleLibrary());
+  // Every track changes, three times over; results must stay exact through the rebuilds.
+  for (int round = 0; round < 3; round++) {
+    std::string title = "Round " + std::to_string(round);
+    index.update(makeLibrary({makeTrack("Music/one.mp3", title), makeTrack("Music/two.mp3")}));
+    EXPECT_EQ(index.find(title), Positions({0})) << round;
+    EXPECT_EQ(index.find("round"), Positions({0})) << round;
+    EXPECT_EQ(index.find("mp3"), Positions({0, 1})) << round;
+  }
+  index.update(Library());
+  EXPECT_TRUE(index.find("mp3").empty());
+}
+
+TEST(SearchIndexTest, DuplicatePathsKeepTheLastCopy) {
+  SearchIndex index(makeLibrary({
+      makeTrack("a/one.mp3", "First"),
+      makeTrack("a/one.mp3", "Second"),
+  }));
+  EXPECT_TRUE(index.find("first").empty());
+  EXPECT_EQ(index.find("second"), Positions({1}));
+  EXPECT_EQ(index.find("one"), Positions({1}));
+}
+
+// A new path listed twice used to find its first copy's document, which was past the end of the
+// documents that existed before the update.
+TEST(SearchIndexTest, UpdateWithDuplicatePaths) {
+  SearchIndex index(makeLibrary({makeTrack("a/one.mp3")}));
+  index.update(makeLibrary({
+      makeTrack("a/one.mp3"),
+      makeTrack("b/new.mp3"),
+      makeTrack("b/new.mp3"),
+  }));
+  EXPECT_EQ(index.find("new"), Positions({2}));
+  EXPECT_EQ(index.find("one"), Positions({0}));
+
+  // A changed path listed twice, with different metadata each time.
+  index.update(makeLibrary({
+      makeTrack("a/one.mp3", "Changed"),
+      makeTrack("a/one.mp3", "Again"),
+      makeTrack("b/new.mp3"),
+  }));
+  EXPECT_TRUE(index.find("changed").empty());
+  EXPECT_EQ(index.find("again"), Positions({1}));
+  EXPECT_EQ(index.find("mp3"), Positions({1, 2}));
+
+  // And back to one copy each.
+  index.update(makeLibrary({makeTrack("a/one.mp3", "Again"), makeTrack("b/new.mp3")}));
+  EXPECT_EQ(index.find("again"), Positions({0}));
+  EXPECT_EQ(index.find("mp3"), Positions({0, 1}));
+}
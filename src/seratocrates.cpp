@@ -1,55 +1,29 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
-#include <unordered_map>
+#include <map>
+#include <unordered_set>
 
 #include "seratocrates.h"
+#include "library_reader.h"
+#include "parallel.h"
+#include "perf_counters.h"
 #include "read_disk_files.h"
+#include "track_index.h"
 
 
-class CrateReader {
-public:
-  CrateReader(const std::vector<std::shared_ptr<Track>>& library_tracks) {
-    for (const std::shared_ptr<Track>& track : library_tracks) {
-      path_to_track_[track->path] = track;
-    }
-  }
-
-  Crate read(const std::string& path) {
-    CrateFile crate_file = *readFromPath<CrateFile>(path);
-    Crate ret = crate_file;
-
-    // Populate Crate::name. The crate's name is not actually stored in the .crate file itself;
-    // it's only stored in the filename.
-    ret.name = std::filesystem::path(path).stem();
-
-    for (const CrateFileTrack& crate_file_track : crate_file.tracks) {
-      auto itr = path_to_track_.find(crate_file_track.path);
-      if (itr == path_to_track_.end()) {
-        // Crate track was not in database, silently ignore it.
-        continue;
-      }
-      ret.tracks.push_back(itr->second);
-    }
-
-    return ret;
-  }
-
-private:
-  std::unordered_map<std::string, std::shared_ptr<Track>> path_to_track_;
-};
-
-
-// Helper used in nestCrates
-std::vector<std::string> crateNamePieces(const Crate& crate) {
+// Helper used in nestCrates and CrateCatalog.
+std::vector<std::string> crateNamePieces(const std::string& name) {
   std::vector<std::string> ret;
   size_t piece_start = 0;
-  for (size_t i = 1; i < crate.name.size(); i++) {
-    if (crate.name[i] == '%' && crate.name[i + 1] == '%') {
-      ret.push_back(crate.name.substr(piece_start, i - piece_start));
+  for (size_t i = 1; i < name.size(); i++) {
+    if (name[i] == '%' && name[i + 1] == '%') {
+      ret.push_back(name.substr(piece_start, i - piece_start));
       piece_start = i = i + 2;
     }
   }
-  ret.push_back(crate.name.substr(piece_start));
+  ret.push_back(name.substr(piece_start));
   return ret;
 }
 
@@ -64,7 +38,7 @@ std::vector<Crate> nestCrates(std::vector<Crate>&& crates) {
   std::map<std::vector<std::string>, Crate*> pieces_to_crate;
 
   for (auto& crate : crates) {
-    pieces_to_crate[crateNamePieces(crate)] = &crate;
+    pieces_to_crate[crateNamePieces(crate.name)] = &crate;
   }
 
   for (auto it = pieces_to_crate.rbegin(); it != pieces_to_crate.rend(); it++) {
@@ -103,29 +77,281 @@ std::vector<Crate> nestCrates(std::vector<Crate>&& crates) {
 }
 
 
-std::unique_ptr<Library> readLibrary(const std::string& path) {
+void addToTotal(LoadProgress* progress, const std::vector<std::string>& files) {
+  if (!progress) {
+    return;
+  }
+  uint64_t total = 0;
+  for (const std::string& file : files) {
+    total += file.size();
+  }
+  progress->bytes_total += total;
+}
+
+
+std::vector<std::string> listCrateFiles(const std::string& crates_dir) {
+  std::vector<std::string> ret;
+  for (std::filesystem::path crate_path : std::filesystem::directory_iterator(crates_dir)) {
+    if (crate_path.extension() != ".crate") {
+      // All files in this folder should be .crate files, but just in case skip file if it
+      // doesn't have .crate extension.
+      continue;
+    }
+
+    ret.push_back(crate_path.native());
+  }
+  // Compare without the extension, so that "A.crate" sorts before its subcrate "A%%B.crate".
+  std::sort(ret.begin(), ret.end(), [](const std::string& a, const std::string& b) {
+    return a.compare(0, a.size() - strlen(".crate"), b, 0, b.size() - strlen(".crate")) < 0;
+  });
+  return ret;
+}
+
+
+std::unique_ptr<Library> readLibrary(const std::string& path, const ReadOptions& options) {
   std::filesystem::path root_path{path};
   std::filesystem::path serato_dir_path = root_path / "_Serato_";
   std::filesystem::path database_path = serato_dir_path / "database V2";
   std::filesystem::path crates_dir_path = serato_dir_path / "Subcrates";
 
-  std::unique_ptr<DatabaseFile> database_file = readFromPath<DatabaseFile>(database_path.native());
+  std::unique_ptr<DatabaseFile> database_file;
+  {
+    PhaseTimer timer(options, &LoadStats::database_seconds);
+    database_file = readFromPath<DatabaseFile>(database_path.native(), options);
+  }
   std::unique_ptr<Library> ret = std::make_unique<Library>(*database_file);
 
-  CrateReader crate_reader(database_file->tracks);
+  CrateReader crate_reader(database_file->tracks, options);
 
-  // TODO This does not correctly handle subcrates.
-  for (std::filesystem::path crate_path : std::filesystem::directory_iterator(crates_dir_path)) {
-    if (crate_path.extension() != ".crate") {
-      // All files in this folder should be .crate files, but just in case skip file if it doesn't
-      // have .crate extension.
+  std::vector<std::string> crate_paths;
+  {
+    PhaseTimer timer(options, &LoadStats::list_crates_seconds);
+    crate_paths = listCrateFiles(crates_dir_path.native());
+  }
+
+  // Crate files are small and there are often hundreds of them, so read them all in one batch.
+  std::vector<std::string> crate_contents;
+  std::vector<FileVersion> crate_versions;
+  {
+    PhaseTimer timer(options, &LoadStats::parse_crates_seconds);
+    crate_contents = readFiles(crate_paths, options, &crate_versions);
+  }
+  addToTotal(options.progress, crate_contents);
+  for (size_t i = 0; i < crate_paths.size(); i++) {
+    checkCancelled(options.progress);
+    ret->crates.push_back(crate_reader.read(crate_paths[i], crate_contents[i], &crate_versions[i]));
+  }
+
+  PhaseTimer timer(options, &LoadStats::nest_seconds);
+  ret->crates = nestCrates(std::move(ret->crates));
+
+  return ret;
+}
+
+
+void streamLibrary(
+    const std::string& path, const LibraryCallbacks& callbacks, const ReadOptions& options) {
+  std::filesystem::path serato_dir_path = std::filesystem::path(path) / "_Serato_";
+
+  // Only the paths are kept, so that crate tracks can be resolved.
+  std::vector<std::string> track_paths;
+  {
+    PhaseTimer timer(options, &LoadStats::database_seconds);
+    std::string database =
+        readFile((serato_dir_path / "database V2").native(), options);
+    if (options.progress) {
+      options.progress->bytes_total += database.size();
+    }
+    forEachDatabaseTrack(database, options, [&](const Track& track) {
+      if (callbacks.on_track) {
+        callbacks.on_track(track);
+      }
+      if (callbacks.on_crate) {
+        track_paths.push_back(track.path);
+      }
+    });
+  }
+  if (!callbacks.on_crate) {
+    return;
+  }
+
+  std::vector<std::string> crate_paths;
+  {
+    PhaseTimer timer(options, &LoadStats::list_crates_seconds);
+    crate_paths = listCrateFiles((serato_dir_path / "Subcrates").native());
+  }
+  std::vector<std::string> crate_contents;
+  std::vector<FileVersion> crate_versions;
+  {
+    PhaseTimer timer(options, &LoadStats::parse_crates_seconds);
+    crate_contents = readFiles(crate_paths, options, &crate_versions);
+  }
+  addToTotal(options.progress, crate_contents);
+
+  PathResolver resolver(track_paths, options);
+  std::vector<std::string> crate_tracks;
+  for (size_t i = 0; i < crate_paths.size(); i++) {
+    checkCancelled(options.progress);
+    std::unique_ptr<CrateFile> crate_file;
+    {
+      PhaseTimer timer(options, &LoadStats::parse_crates_seconds);
+      crate_file = parseReadFile<CrateFile>(
+          crate_paths[i], crate_contents[i], crate_versions[i], options);
+    }
+    {
+      PhaseTimer timer(options, &LoadStats::resolve_seconds);
+      crate_tracks.clear();
+      for (const CrateFileTrack& crate_file_track : crate_file->tracks) {
+        size_t pos = resolver.find(crate_file_track.path);
+        if (pos != TrackIndex::kNotFound) {
+          crate_tracks.push_back(track_paths[pos]);
+        }
+      }
+    }
+    callbacks.on_crate(std::filesystem::path(crate_paths[i]).stem().native(), crate_tracks);
+  }
+}
+
+
+// Helper used in crateNamesByTrack.
+void addCrateNames(const Crate& crate, const std::string& prefix,
+                   std::unordered_map<const Track*, std::vector<std::string>>* track_crates) {
+  std::string name = prefix.empty() ? crate.name : prefix + "%%" + crate.name;
+  for (const std::shared_ptr<Track>& track : crate.tracks) {
+    std::vector<std::string>& names = (*track_crates)[track.get()];
+    if (names.empty() || names.back() != name) {
+      names.push_back(name);
+    }
+  }
+  for (const Crate& subcrate : crate.subcrates) {
+    addCrateNames(subcrate, name, track_crates);
+  }
+}
+
+
+std::unordered_map<const Track*, std::vector<std::string>> crateNamesByTrack(
+    const Library& library) {
+  std::unordered_map<const Track*, std::vector<std::string>> ret;
+  for (const Crate& crate : library.crates) {
+    addCrateNames(crate, "", &ret);
+  }
+  return ret;
+}
+
+
+// Helper used in readLibraries. Replaces each of crate's tracks by the track with the same path
+// in merged_tracks.
+void remapCrateTracks(
+    Crate* crate, const std::vector<std::shared_ptr<Track>>& merged_tracks,
+    const TrackIndex& merged_index) {
+  for (std::shared_ptr<Track>& track : crate->tracks) {
+    track = merged_tracks[merged_index.find(track->path)];
+  }
+  for (Crate& subcrate : crate->subcrates) {
+    remapCrateTracks(&subcrate, merged_tracks, merged_index);
+  }
+}
+
+
+// Helper used in readLibraries. Moves each crate in from into into, unioning it with any crate of
+// the same name that's already there.
+void mergeCrates(std::vector<Crate>* into, std::vector<Crate>&& from) {
+  for (Crate& crate : from) {
+    auto existing = std::find_if(into->begin(), into->end(), [&](const Crate& other) {
+      return other.name == crate.name;
+    });
+    if (existing == into->end()) {
+      into->emplace_back(std::move(crate));
       continue;
     }
 
-    ret->crates.push_back(crate_reader.read(crate_path.native()));
+    std::unordered_set<const Track*> present;
+    for (const std::shared_ptr<Track>& track : existing->tracks) {
+      present.insert(track.get());
+    }
+    for (std::shared_ptr<Track>& track : crate.tracks) {
+      if (present.insert(track.get()).second) {
+        existing->tracks.emplace_back(std::move(track));
+      }
+    }
+    mergeCrates(&existing->subcrates, std::move(crate.subcrates));
   }
+}
 
-  ret->crates = nestCrates(std::move(ret->crates));
+
+void addStats(LoadStats* into, const LoadStats& from) {
+  into->database_seconds += from.database_seconds;
+  into->list_crates_seconds += from.list_crates_seconds;
+  into->parse_crates_seconds += from.parse_crates_seconds;
+  into->resolve_seconds += from.resolve_seconds;
+  into->nest_seconds += from.nest_seconds;
+  into->bytes_read += from.bytes_read;
+  into->records_visited += from.records_visited;
+  into->unknown_tags_skipped += from.unknown_tags_skipped;
+  into->unresolved_crate_tracks += from.unresolved_crate_tracks;
+  into->allocations += from.allocations;
+  into->torn_read_retries += from.torn_read_retries;
+  into->hardware_counters_available |= from.hardware_counters_available;
+  for (HardwareCounters LoadStats::*phase : {
+           &LoadStats::database_counters, &LoadStats::list_crates_counters,
+           &LoadStats::parse_crates_counters, &LoadStats::resolve_counters,
+           &LoadStats::nest_counters}) {
+    addCounters(&(into->*phase), from.*phase);
+  }
+}
+
+
+std::unique_ptr<Library> readLibraries(
+    const std::vector<std::string>& roots, const ReadOptions& options) {
+  std::vector<std::unique_ptr<Library>> libraries(roots.size());
+  // Each root gets its own stats so that the threads don't race on the counters.
+  std::vector<LoadStats> root_stats(options.stats ? roots.size() : 0);
+  // Each root is usually on its own drive, so use a thread per root regardless of core count.
+  parallelFor(roots.size(), [&](size_t i) {
+    ReadOptions root_options = options;
+    root_options.stats = options.stats ? &root_stats[i] : nullptr;
+    libraries[i] = readLibrary(roots[i], root_options);
+    for (const std::shared_ptr<Track>& track : libraries[i]->tracks) {
+      track->path = (std::filesystem::path(roots[i]) / track->path).native();
+    }
+  }, roots.size());
+
+  for (const LoadStats& stats : root_stats) {
+    addStats(options.stats, stats);
+  }
+
+  std::unique_ptr<Library> ret = std::make_unique<Library>();
+  if (!libraries.empty()) {
+    ret->version = libraries.front()->version;
+  }
+
+  // All tracks, with the roots in reverse order. TrackIndex resolves duplicate paths to the last
+  // one, so this makes the first root that has a path win (and within a root, the same track as
+  // in readLibrary).
+  std::vector<std::shared_ptr<Track>> all_tracks;
+  for (auto library = libraries.rbegin(); library != libraries.rend(); ++library) {
+    all_tracks.insert(all_tracks.end(), (*library)->tracks.begin(), (*library)->tracks.end());
+  }
+  TrackIndex all_index(all_tracks);
+
+  // Keep one track per path, in order of first appearance.
+  std::vector<bool> kept(all_tracks.size());
+  for (const std::unique_ptr<Library>& library : libraries) {
+    for (const std::shared_ptr<Track>& track : library->tracks) {
+      size_t pos = all_index.find(track->path);
+      if (!kept[pos]) {
+        kept[pos] = true;
+        ret->tracks.push_back(all_tracks[pos]);
+      }
+    }
+  }
+
+  for (std::unique_ptr<Library>& library : libraries) {
+    for (Crate& crate : library->crates) {
+      remapCrateTracks(&crate, all_tracks, all_index);
+    }
+    mergeCrates(&ret->crates, std::move(library->crates));
+  }
 
   return ret;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
@@ -7,6 +10,17 @@
 
 struct Track {
   std::string path;
+  std::string title;
+  std::string artist;
+  std::string album;
+  std::string comment;
+  // These are stored as text, exactly as Serato writes them: bpm like "128.00", key like "Am" or
+  // "8A", and length like "03:45.12". See track_indexes.h for parsed versions.
+  std::string bpm;
+  std::string key;
+  std::string length;
+  // Seconds since the Unix epoch, or 0 if unknown.
+  uint32_t date_added = 0;
 };
 
 struct Crate {
@@ -27,6 +41,125 @@ public:
   using runtime_error::runtime_error;
 };
 
+// Thrown when a load is cancelled through LoadProgress::cancel.
+class LoadCancelled : public ReadException {
+public:
+  using ReadException::ReadException;
+};
+
+// Lets another thread follow a load and cancel it. Pass one in ReadOptions::progress.
+//
+// The loader publishes its progress and checks for cancellation once every few thousand records
+// (and between files), so a cancelled load stops within a few milliseconds by throwing
+// LoadCancelled.
+struct LoadProgress {
+  // Bytes of the files being loaded that have been parsed so far.
+  std::atomic<uint64_t> bytes_done{0};
+  // Total bytes of the files being loaded. This grows as the load reads more files (for
+  // readLibrary: first the database, and then all of the crates at once).
+  std::atomic<uint64_t> bytes_total{0};
+  // Set this to true to cancel the load.
+  std::atomic<bool> cancel{false};
+};
+
+class Tracer;
+
+// Hardware event counts for one phase of a load. See ReadOptions::count_hardware_events.
+struct HardwareCounters {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cache_misses = 0;
+  uint64_t branch_misses = 0;
+};
+
+// Where the time went during a load, and how much work it did. Phase times are wall-clock seconds;
+// for readLibraries they're summed over all roots.
+struct LoadStats {
+  // Reading and parsing "database V2".
+  double database_seconds = 0;
+  // Listing the Subcrates directory.
+  double list_crates_seconds = 0;
+  // Reading and parsing .crate files.
+  double parse_crates_seconds = 0;
+  // Looking up crate tracks in the database.
+  double resolve_seconds = 0;
+  // Building the subcrate tree (nestCrates).
+  double nest_seconds = 0;
+
+  uint64_t bytes_read = 0;
+  // Records (of any type, at any nesting level) whose headers were parsed.
+  uint64_t records_visited = 0;
+  // Records skipped because we don't know their tag.
+  uint64_t unknown_tags_skipped = 0;
+  // Crate tracks that weren't found in the database and were dropped.
+  uint64_t unresolved_crate_tracks = 0;
+  // Tracks, crates and non-empty strings allocated while decoding.
+  uint64_t allocations = 0;
+  // Files that changed while they were being read (e.g. because Serato was rewriting them) and
+  // were read again.
+  uint64_t torn_read_retries = 0;
+
+  // Hardware event counts for each phase, if ReadOptions::count_hardware_events was set. They
+  // include threads that the phase starts (e.g. for the parallel database parse). If the counters
+  // couldn't be opened these stay zero and hardware_counters_available is false.
+  bool hardware_counters_available = false;
+  HardwareCounters database_counters;
+  HardwareCounters list_crates_counters;
+  HardwareCounters parse_crates_counters;
+  HardwareCounters resolve_counters;
+  HardwareCounters nest_counters;
+};
+
+struct ReadOptions {
+  // If true, crate tracks whose paths don't exactly match a database path are looked up again
+  // ignoring case and Unicode normalization form. This helps with libraries that have moved
+  // between macOS (which writes NFD paths) and other platforms. The normalized index is only
+  // built if a crate track misses the exact lookup.
+  bool match_normalized_paths = false;
+
+  // If not null, filled in (added to) during the load. Collecting stats is skipped entirely when
+  // this is null.
+  LoadStats* stats = nullptr;
+
+  // If not null, updated during the load, which can be cancelled through it. See LoadProgress.
+  LoadProgress* progress = nullptr;
+
+  // If true (and stats isn't null), also count CPU cycles, instructions, cache misses and branch
+  // mispredictions in each phase of the load with perf_event_open(2). This only works on Linux,
+  // and needs permission to use performance counters (see /proc/sys/kernel/perf_event_paranoid);
+  // otherwise the load goes ahead without them. Each phase costs a few extra system calls.
+  bool count_hardware_events = false;
+
+  // If not null, a span is recorded in it for each step of the load. See tracer.h.
+  Tracer* tracer = nullptr;
+};
+
 // readLibrary takes the path to the directory containing the _Serato_ folder (not the path to the
 // _Serato_ folder itself).
-std::unique_ptr<Library> readLibrary(const std::string& path);
+std::unique_ptr<Library> readLibrary(
+    const std::string& path, const ReadOptions& options = ReadOptions());
+
+// readLibraries reads the libraries at each of roots (each as for readLibrary) concurrently and
+// merges them into one, e.g. to combine the _Serato_ folders on several external drives. Serato
+// stores track paths relative to the root of the volume holding the _Serato_ folder, so each
+// track's path is prefixed with its root. Tracks that end up with the same path are merged, keeping
+// the metadata from the first root that has the path, and crates with the same name (at the same
+// nesting level) are unioned.
+std::unique_ptr<Library> readLibraries(
+    const std::vector<std::string>& roots, const ReadOptions& options = ReadOptions());
+
+struct LibraryCallbacks {
+  // Called for each track in the database, in order. The track is only valid during the call.
+  std::function<void(const Track& track)> on_track;
+  // Called for each crate after all tracks, in order of name. name is Serato's name for the crate
+  // ("Parent%%Child"), and tracks holds the database paths of its tracks. Crate tracks that aren't
+  // in the database are dropped, as in readLibrary.
+  std::function<void(const std::string& name, const std::vector<std::string>& tracks)> on_crate;
+};
+
+// streamLibrary reads the library at path (as for readLibrary) without building a Library: each
+// track is passed to callbacks.on_track as soon as it's parsed and then discarded. If on_crate is
+// set, the tracks' paths are kept to resolve crates against; otherwise crates aren't read at all.
+void streamLibrary(
+    const std::string& path, const LibraryCallbacks& callbacks,
+    const ReadOptions& options = ReadOptions());
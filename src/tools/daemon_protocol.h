@@ -0,0 +1,175 @@
+// This file describes the protocol spoken by serato_library_daemon over its Unix socket, and
+// contains helpers for encoding and decoding it.
+//
+// Every message is a frame:
+//   u32 length      Bytes in the rest of the frame.
+//   u32 request_id  Chosen by the client and echoed in the response; 0 for events.
+//   u8 type         A DaemonOp in requests, a DaemonStatus in responses.
+//   payload
+// Integers are little-endian. Strings are a u32 byte count followed by UTF-8 bytes.
+//
+// Clients may send any number of requests without waiting for responses (pipelining). Responses
+// on a connection come back in the order the requests were sent.
+//
+// Every DaemonStatus::kOk response payload starts with the u64 version of the library that
+// answered it. Track positions are only meaningful within a version: after a reload, tracks may
+// move. So kGetTracks names the version its positions came from, and gets a kVersionMismatch
+// response if the library has been reloaded since; the client should start over.
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+enum class DaemonOp : uint8_t {
+  // -> u32 count, then per crate: string name ("Parent%%Child"), u32 track count.
+  kListCrates = 1,
+  // string name -> u32 count, u32 position...
+  kCrateTracks = 2,
+  // u64 version, u32 count, u32 position... -> u32 count, then per track: string path, title,
+  // artist, album, comment, bpm, key, length, u32 date_added.
+  kGetTracks = 3,
+  // string path -> u32 position, or kNoPosition.
+  kFindPath = 4,
+  // u8 prefix_only, string query, u32 limit -> u32 total matches, u32 count, u32 position...
+  kSearch = 5,
+  // -> (empty). Afterwards, each reload sends an event frame (request_id 0, kEvent) whose payload
+  // is the new u64 version.
+  kSubscribe = 6,
+  // -> u32 track count.
+  kVersion = 7,
+};
+
+enum class DaemonStatus : uint8_t {
+  kOk = 0,
+  // Payload is a string describing the error.
+  kError = 1,
+  kEvent = 2,
+  // The request named a version of the library other than the current one. Payload is the
+  // current u64 version.
+  kVersionMismatch = 3,
+};
+
+const uint32_t kNoPosition = UINT32_MAX;
+const size_t kHeaderSize = 4 + 4 + 1;
+// Frames longer than this are rejected, so a bad client can't make the server allocate at will.
+const uint32_t kMaxFrameLength = 64 << 20;
+
+class ProtocolError : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+// Appends a frame to a buffer.
+class FrameWriter {
+public:
+  FrameWriter(std::string* out, uint32_t request_id, uint8_t type)
+      : out_(out), start_(out->size()) {
+    u32(0);
+    u32(request_id);
+    u8(type);
+  }
+
+  // Fills in the frame's length. Call once everything has been written.
+  void finish() {
+    uint32_t length = out_->size() - start_ - 4;
+    // Little-endian, like u32.
+    for (int i = 0; i < 4; i++) {
+      (*out_)[start_ + i] = static_cast<char>(length >> (8 * i));
+    }
+  }
+
+  void u8(uint8_t value) {
+    out_->push_back(static_cast<char>(value));
+  }
+
+  void u32(uint32_t value) {
+    char bytes[4] = {char(value), char(value >> 8), char(value >> 16), char(value >> 24)};
+    out_->append(bytes, 4);
+  }
+
+  void u64(uint64_t value) {
+    u32(static_cast<uint32_t>(value));
+    u32(static_cast<uint32_t>(value >> 32));
+  }
+
+  void str(std::string_view value) {
+    u32(value.size());
+    out_->append(value.data(), value.size());
+  }
+
+private:
+  std::string* out_;
+  size_t start_;
+};
+
+// Reads the fields of a frame's payload. Throws ProtocolError if it runs past the end.
+class PayloadReader {
+public:
+  explicit PayloadReader(std::string_view payload) : payload_(payload) {}
+
+  uint8_t u8() {
+    need(1);
+    return static_cast<uint8_t>(payload_[pos_++]);
+  }
+
+  uint32_t u32() {
+    need(4);
+    uint32_t ret = 0;
+    for (int i = 3; i >= 0; i--) {
+      ret = ret << 8 | static_cast<uint8_t>(payload_[pos_ + i]);
+    }
+    pos_ += 4;
+    return ret;
+  }
+
+  uint64_t u64() {
+    uint64_t low = u32();
+    return low | static_cast<uint64_t>(u32()) << 32;
+  }
+
+  std::string_view str() {
+    uint32_t size = u32();
+    need(size);
+    std::string_view ret = payload_.substr(pos_, size);
+    pos_ += size;
+    return ret;
+  }
+
+private:
+  void need(size_t bytes) {
+    if (payload_.size() - pos_ < bytes) {
+      throw ProtocolError("Frame is truncated");
+    }
+  }
+
+  std::string_view payload_;
+  size_t pos_ = 0;
+};
+
+struct Frame {
+  uint32_t request_id;
+  uint8_t type;
+  std::string_view payload;
+};
+
+// If buffer starts with a whole frame, stores it in frame (pointing into buffer) and returns its
+// total size; otherwise returns 0.
+inline size_t parseFrame(std::string_view buffer, Frame* frame) {
+  if (buffer.size() < 4) {
+    return 0;
+  }
+  uint32_t length = PayloadReader(buffer.substr(0, 4)).u32();
+  if (length < kHeaderSize - 4 || length > kMaxFrameLength) {
+    throw ProtocolError("Bad frame length");
+  }
+  if (buffer.size() - 4 < length) {
+    return 0;
+  }
+  PayloadReader header(buffer.substr(4, kHeaderSize - 4));
+  frame->request_id = header.u32();
+  frame->type = header.u8();
+  frame->payload = buffer.substr(kHeaderSize, length - (kHeaderSize - 4));
+  return 4 + length;
+}
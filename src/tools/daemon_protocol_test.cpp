@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "daemon_protocol.h"
+
+namespace {
+
+std::string frameWithLength(uint32_t length, size_t body_bytes) {
+  std::string ret(4 + body_bytes, '\0');
+  memcpy(&ret[0], &length, 4);
+  return ret;
+}
+
+}  // namespace
+
+TEST(DaemonProtocolTest, RoundTripsAFrame) {
+  std::string buffer;
+  FrameWriter frame(&buffer, 42, static_cast<uint8_t>(DaemonOp::kSearch));
+  frame.u8(1);
+  frame.str("caf\xc3\xa9");
+  frame.u32(7);
+  frame.u64(0x0102030405060708);
+  frame.finish();
+
+  Frame parsed;
+  ASSERT_EQ(parseFrame(buffer, &parsed), buffer.size());
+  EXPECT_EQ(parsed.request_id, 42u);
+  EXPECT_EQ(parsed.type, static_cast<uint8_t>(DaemonOp::kSearch));
+  PayloadReader in(parsed.payload);
+  EXPECT_EQ(in.u8(), 1);
+  EXPECT_EQ(in.str(), "caf\xc3\xa9");
+  EXPECT_EQ(in.u32(), 7u);
+  EXPECT_EQ(in.u64(), 0x0102030405060708u);
+  EXPECT_THROW(in.u8(), ProtocolError);
+}
+
+TEST(DaemonProtocolTest, IntegersAreLittleEndian) {
+  std::string buffer;
+  FrameWriter frame(&buffer, 0x01020304, 5);
+  frame.finish();
+  EXPECT_EQ(buffer, std::string("\x05\x00\x00\x00\x04\x03\x02\x01\x05", 9));
+}
+
+TEST(DaemonProtocolTest, WaitsForTheRestOfAFrame) {
+  std::string buffer;
+  FrameWriter frame(&buffer, 1, static_cast<uint8_t>(DaemonOp::kFindPath));
+  frame.str("Music/a.mp3");
+  frame.finish();
+
+  Frame parsed;
+  for (size_t size = 0; size < buffer.size(); size++) {
+    EXPECT_EQ(parseFrame(std::string_view(buffer).substr(0, size), &parsed), 0u) << size;
+  }
+  EXPECT_EQ(parseFrame(buffer, &parsed), buffer.size());
+}
+
+TEST(DaemonProtocolTest, ParsesPipelinedFrames) {
+  std::string buffer;
+  for (uint32_t id = 1; id <= 3; id++) {
+    FrameWriter frame(&buffer, id, static_cast<uint8_t>(DaemonOp::kVersion));
+    frame.finish();
+  }
+  // Plus the first byte of a fourth.
+  buffer.push_back('\x05');
+
+  std::string_view rest = buffer;
+  Frame parsed;
+  for (uint32_t id = 1; id <= 3; id++) {
+    size_t size = parseFrame(rest, &parsed);
+    ASSERT_EQ(size, kHeaderSize);
+    EXPECT_EQ(parsed.request_id, id);
+    EXPECT_TRUE(parsed.payload.empty());
+    rest.remove_prefix(size);
+  }
+  EXPECT_EQ(parseFrame(rest, &parsed), 0u);
+}
+
+TEST(DaemonProtocolTest, RejectsLengthsShorterThanTheHeader) {
+  Frame parsed;
+  for (uint32_t length = 0; length < kHeaderSize - 4; length++) {
+    EXPECT_THROW(parseFrame(frameWithLength(length, 8), &parsed), ProtocolError) << length;
+  }
+}
+
+TEST(DaemonProtocolTest, RejectsOversizedLengthsBeforeTheBodyArrives) {
+  Frame parsed;
+  EXPECT_THROW(parseFrame(frameWithLength(kMaxFrameLength + 1, 0), &parsed), ProtocolError);
+  EXPECT_THROW(parseFrame(frameWithLength(UINT32_MAX, 0), &parsed), ProtocolError);
+  EXPECT_EQ(parseFrame(frameWithLength(kMaxFrameLength, 16), &parsed), 0u);
+}
+
+TEST(DaemonProtocolTest, ReaderRejectsStringsPastTheEnd) {
+  std::string payload;
+  FrameWriter frame(&payload, 0, 0);
+  frame.u32(100);
+  payload.append("short");
+  PayloadReader in(std::string_view(payload).substr(kHeaderSize));
+  EXPECT_THROW(in.str(), ProtocolError);
+}
+
+TEST(DaemonProtocolTest, ReaderRejectsTruncatedIntegers) {
+  EXPECT_THROW(PayloadReader(std::string_view("\x01\x02\x03", 3)).u32(), ProtocolError);
+  EXPECT_THROW(PayloadReader(std::string_view("\x01\x02\x03\x04\x05", 5)).u64(), ProtocolError);
+  EXPECT_THROW(PayloadReader(std::string_view()).u8(), ProtocolError);
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Generates src/unicode_tables.h from the Unicode database bundled with Python.
+#
+# Usage:
+#   python3 src/tools/gen_unicode_tables.py > src/unicode_tables.h
+
+import unicodedata
+
+
+def rows(entries, per_line):
+    out = []
+    for i in range(0, len(entries), per_line):
+        out.append('  ' + ' '.join(entries[i:i + per_line]))
+    return '\n'.join(out)
+
+
+def main():
+    decompositions = []
+    compositions = []
+    lowercase = []
+    combining_classes = []
+
+    for cp in range(0x110000):
+        c = chr(cp)
+
+        d = unicodedata.decomposition(c)
+        if d and not d.startswith('<'):
+            parts = [int(x, 16) for x in d.split()]
+            first = parts[0]
+            second = parts[1] if len(parts) > 1 else 0
+            decompositions.append('{0x%x, 0x%x, 0x%x},' % (cp, first, second))
+            # Primary composites are the two-codepoint decompositions that NFC recomposes.
+            if second and unicodedata.normalize('NFC', chr(first) + chr(second)) == c:
+                compositions.append((first, second, cp))
+
+        lower = c.lower()
+        if len(lower) == 1 and lower != c:
+            lowercase.append('{0x%x, 0x%x},' % (cp, ord(lower)))
+
+        ccc = unicodedata.combining(c)
+        if ccc:
+            if combining_classes and combining_classes[-1][1] == cp - 1 \
+                    and combining_classes[-1][2] == ccc:
+                combining_classes[-1][1] = cp
+            else:
+                combining_classes.append([cp, cp, ccc])
+
+    compositions.sort()
+
+    print('// Generated by src/tools/gen_unicode_tables.py from Unicode %s. Do not edit.'
+          % unicodedata.unidata_version)
+    print('#pragma once')
+    print()
+    print('#include <cstdint>')
+    print()
+    print('struct UnicodeDecomposition {\n  char32_t cp;\n  char32_t first;\n'
+          '  char32_t second;  // 0 for singleton decompositions.\n};')
+    print()
+    print('struct UnicodeComposition {\n  char32_t first;\n  char32_t second;\n'
+          '  char32_t composite;\n};')
+    print()
+    print('struct UnicodeMapping {\n  char32_t from;\n  char32_t to;\n};')
+    print()
+    print('struct UnicodeCombiningClassRange {\n  char32_t first;\n  char32_t last;\n'
+          '  uint8_t ccc;\n};')
+    print()
+    print('// Canonical decompositions, sorted by cp. Hangul syllables are decomposed')
+    print('// algorithmically and aren\'t listed.')
+    print('inline constexpr UnicodeDecomposition kUnicodeDecompositions[] = {')
+    print(rows(decompositions, 4))
+    print('};')
+    print()
+    print('// Primary composites, sorted by (first, second).')
+    print('inline constexpr UnicodeComposition kUnicodeCompositions[] = {')
+    print(rows(['{0x%x, 0x%x, 0x%x},' % c for c in compositions], 4))
+    print('};')
+    print()
+    print('// Simple (single codepoint) lowercase mappings, sorted by from.')
+    print('inline constexpr UnicodeMapping kUnicodeLowercase[] = {')
+    print(rows(lowercase, 6))
+    print('};')
+    print()
+    print('// Nonzero canonical combining classes, sorted by first.')
+    print('inline constexpr UnicodeCombiningClassRange kUnicodeCombiningClasses[] = {')
+    print(rows(['{0x%x, 0x%x, %d},' % tuple(r) for r in combining_classes], 4))
+    print('};')
+
+
+if __name__ == '__main__':
+    main()
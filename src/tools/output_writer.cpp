@@ -0,0 +1,121 @@
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "output_writer.h"
+
+namespace {
+
+bool needsJsonEscape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Returns the position of the first byte in text at or after pos that needs escaping, or
+// text.size().
+size_t findJsonEscape(std::string_view text, size_t pos) {
+#ifdef __SSE2__
+  // Check 16 bytes at a time. SSE2 only has signed byte comparisons, so flip the top bit to get
+  // an unsigned "less than 0x20".
+  const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+  const __m128i control_limit = _mm_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; pos + 16 <= text.size(); pos += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + pos));
+    __m128i escape = _mm_or_si128(
+        _mm_cmplt_epi8(_mm_xor_si128(block, flip), control_limit),
+        _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+    int mask = _mm_movemask_epi8(escape);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; pos < text.size(); pos++) {
+    if (needsJsonEscape(text[pos])) {
+      return pos;
+    }
+  }
+  return pos;
+}
+
+}  // namespace
+
+
+void OutputWriter::write(std::string_view text) {
+  if (text.size() > sizeof(buffer_) - size_) {
+    flush();
+    if (text.size() > sizeof(buffer_)) {
+      fwrite(text.data(), 1, text.size(), file_);
+      return;
+    }
+  }
+  memcpy(buffer_ + size_, text.data(), text.size());
+  size_ += text.size();
+}
+
+void OutputWriter::writeUint(uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[sizeof(digits) - ++count] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  write(std::string_view(digits + sizeof(digits) - count, count));
+}
+
+void OutputWriter::writeJsonString(std::string_view text) {
+  static const char kHex[] = "0123456789abcdef";
+  write('"');
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t escape = findJsonEscape(text, pos);
+    write(text.substr(pos, escape - pos));
+    if (escape == text.size()) {
+      break;
+    }
+    unsigned char c = text[escape];
+    write('\\');
+    switch (c) {
+      case '"': write('"'); break;
+      case '\\': write('\\'); break;
+      case '\b': write('b'); break;
+      case '\f': write('f'); break;
+      case '\n': write('n'); break;
+      case '\r': write('r'); break;
+      case '\t': write('t'); break;
+      default:
+        write("u00");
+        write(kHex[c >> 4]);
+        write(kHex[c & 0xf]);
+    }
+    pos = escape + 1;
+  }
+  write('"');
+}
+
+void OutputWriter::writeCsvField(std::string_view text) {
+  if (text.find_first_of(",\"\r\n") == std::string_view::npos) {
+    write(text);
+    return;
+  }
+  write('"');
+  size_t pos = 0;
+  for (size_t quote = text.find('"'); quote != std::string_view::npos;
+       quote = text.find('"', pos)) {
+    write(text.substr(pos, quote + 1 - pos));
+    write('"');
+    pos = quote + 1;
+  }
+  write(text.substr(pos));
+  write('"');
+}
+
+void OutputWriter::flush() {
+  if (size_ > 0) {
+    fwrite(buffer_, 1, size_, file_);
+    size_ = 0;
+  }
+}
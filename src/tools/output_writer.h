@@ -0,0 +1,41 @@
+// This file contains OutputWriter, a buffered writer for print_serato_library's export formats.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+// OutputWriter collects output in a fixed buffer and hands it to the FILE* in large writes, which
+// is much cheaper than a formatted stream write per field.
+class OutputWriter {
+public:
+  explicit OutputWriter(FILE* file) : file_(file) {}
+  ~OutputWriter() {
+    flush();
+  }
+
+  OutputWriter(const OutputWriter&) = delete;
+  OutputWriter& operator=(const OutputWriter&) = delete;
+
+  void write(std::string_view text);
+  void write(char c) {
+    if (size_ == sizeof(buffer_)) {
+      flush();
+    }
+    buffer_[size_++] = c;
+  }
+  void writeUint(uint64_t value);
+
+  // Writes text as a quoted JSON string. text must be UTF-8; only '"', '\' and control characters
+  // are escaped.
+  void writeJsonString(std::string_view text);
+  // Writes text as a CSV field (RFC 4180), quoting it only if it needs to be.
+  void writeCsvField(std::string_view text);
+
+  void flush();
+
+private:
+  FILE* file_;
+  char buffer_[1 << 16];
+  size_t size_ = 0;
+};
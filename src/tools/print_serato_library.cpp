@@ -1,20 +1,298 @@
 #include "seratocrates.h"
+#include "output_writer.h"
+#include "tracer.h"
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 // Usage:
-//   print_serato_library [path]
-// Reads the Serato library at path (defaults to current directory) and prints its contents.
+//   print_serato_library [--match-normalized-paths] [--stats] [--perf] [--trace=FILE]
+//       [--format=FORMAT] [path...]
+// Reads the Serato library at path (defaults to current directory) and prints its contents. If
+// several paths are given, their libraries are merged (see readLibraries).
+//
+// --match-normalized-paths: see ReadOptions::match_normalized_paths.
+// --stats: print LoadStats for the load to stderr.
+// --perf: like --stats, and also count hardware events (cycles, instructions, cache misses and
+//   branch mispredictions) in each phase; see ReadOptions::count_hardware_events.
+// --trace: write a timeline of the load to FILE as Chrome trace-event JSON; see tracer.h.
+// --format: one of
+//   text (the default): a human-readable listing of tracks and crates.
+//   ndjson: one JSON object per line, first {"type":"track",...} for each track and then
+//     {"type":"crate","name":...,"tracks":[...]} for each crate.
+//   json: a single {"tracks":[...],"crates":[...]} object.
+//   csv: a header row and then one row per track. Crates aren't included.
+// The ndjson, json and csv formats stream tracks out as they're parsed (see streamLibrary)
+// rather than loading the whole library first. With several paths, each library is exported in
+// turn with its root prepended to its paths, but tracks and crates aren't merged.
+
+namespace {
+
+const char* const kTrackFields[] = {
+    "path", "title", "artist", "album", "comment", "bpm", "key", "length", "date_added"};
+
+enum class Format {
+  kText,
+  kNdjson,
+  kJson,
+  kCsv,
+};
+
+// Writes tracks and crates in one of the export formats as they're streamed in.
+class Exporter {
+public:
+  Exporter(Format format, OutputWriter* out) : format_(format), out_(out) {}
+
+  void begin() {
+    if (format_ == Format::kJson) {
+      out_->write("{\"tracks\":[");
+    } else if (format_ == Format::kCsv) {
+      for (const char* field : kTrackFields) {
+        if (field != kTrackFields[0]) {
+          out_->write(',');
+        }
+        out_->write(field);
+      }
+      out_->write("\r\n");
+    }
+  }
+
+  // Paths are written with prefix prepended.
+  void track(const std::string& prefix, const Track& track) {
+    std::string prefixed;
+    const std::string& path = prefix.empty() ? track.path : (prefixed = prefix + track.path);
+    const std::string* values[] = {
+        &path, &track.title, &track.artist, &track.album, &track.comment, &track.bpm, &track.key,
+        &track.length};
+    if (format_ == Format::kCsv) {
+      for (const std::string* value : values) {
+        out_->writeCsvField(*value);
+        out_->write(',');
+      }
+      out_->writeUint(track.date_added);
+      out_->write("\r\n");
+      return;
+    }
+
+    if (format_ == Format::kNdjson) {
+      out_->write("{\"type\":\"track\",");
+    } else {
+      out_->write(tracks_written_++ == 0 ? "\n{" : ",\n{");
+    }
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+      out_->write('"');
+      out_->write(kTrackFields[i]);
+      out_->write("\":");
+      out_->writeJsonString(*values[i]);
+      out_->write(',');
+    }
+    out_->write("\"date_added\":");
+    out_->writeUint(track.date_added);
+    out_->write(format_ == Format::kNdjson ? "}\n" : "}");
+  }
+
+  void beginCrates() {
+    if (format_ == Format::kJson) {
+      out_->write("\n],\"crates\":[");
+    }
+  }
+
+  void crate(const std::string& prefix, const std::string& name,
+             const std::vector<std::string>& tracks) {
+    if (format_ == Format::kNdjson) {
+      out_->write("{\"type\":\"crate\",\"name\":");
+    } else {
+      out_->write(crates_written_++ == 0 ? "\n{\"name\":" : ",\n{\"name\":");
+    }
+    out_->writeJsonString(name);
+    out_->write(",\"tracks\":[");
+    for (size_t i = 0; i < tracks.size(); i++) {
+      if (i > 0) {
+        out_->write(',');
+      }
+      out_->writeJsonString(prefix.empty() ? tracks[i] : prefix + tracks[i]);
+    }
+    out_->write(format_ == Format::kNdjson ? "]}\n" : "]}");
+  }
+
+  void end() {
+    if (format_ == Format::kJson) {
+      out_->write("\n]}\n");
+    }
+  }
+
+private:
+  Format format_;
+  OutputWriter* out_;
+  size_t tracks_written_ = 0;
+  size_t crates_written_ = 0;
+};
+
+// Exports each root's library with exporter, as described above.
+void exportLibraries(const std::vector<std::string>& roots, Format format,
+                     const ReadOptions& options) {
+  OutputWriter out(stdout);
+  Exporter exporter(format, &out);
+  exporter.begin();
+
+  // JSON needs all tracks before any crate, so in that case crates are collected and written at
+  // the end. Other formats write each root's crates as they come.
+  std::vector<std::pair<std::string, std::vector<std::string>>> json_crates;
+  for (const std::string& root : roots) {
+    std::string prefix =
+        roots.size() > 1 ? (std::filesystem::path(root) / "").native() : std::string();
+    LibraryCallbacks callbacks;
+    callbacks.on_track = [&](const Track& track) {
+      exporter.track(prefix, track);
+    };
+    if (format == Format::kJson) {
+      callbacks.on_crate = [&](const std::string& name, const std::vector<std::string>& tracks) {
+        json_crates.emplace_back(name, tracks);
+        for (std::string& track : json_crates.back().second) {
+          track.insert(0, prefix);
+        }
+      };
+    } else if (format == Format::kNdjson) {
+      callbacks.on_crate = [&](const std::string& name, const std::vector<std::string>& tracks) {
+        exporter.crate(prefix, name, tracks);
+      };
+    }
+    streamLibrary(root, callbacks, options);
+  }
+
+  exporter.beginCrates();
+  for (const auto& crate : json_crates) {
+    exporter.crate("", crate.first, crate.second);
+  }
+  exporter.end();
+}
+
+// Prints the LoadStats collected by --stats, if any.
+void printStats(const ReadOptions& options) {
+  if (!options.stats) {
+    return;
+  }
+  const LoadStats& stats = *options.stats;
+  std::cerr << "Load stats:\n";
+  std::cerr << "  Database:           " << stats.database_seconds << " s\n";
+  std::cerr << "  List crates:        " << stats.list_crates_seconds << " s\n";
+  std::cerr << "  Parse crates:       " << stats.parse_crates_seconds << " s\n";
+  std::cerr << "  Resolve tracks:     " << stats.resolve_seconds << " s\n";
+  std::cerr << "  Nest crates:        " << stats.nest_seconds << " s\n";
+  std::cerr << "  Bytes read:         " << stats.bytes_read << '\n';
+  std::cerr << "  Records visited:    " << stats.records_visited << '\n';
+  std::cerr << "  Unknown tags:       " << stats.unknown_tags_skipped << '\n';
+  std::cerr << "  Unresolved tracks:  " << stats.unresolved_crate_tracks << '\n';
+  std::cerr << "  Allocations:        " << stats.allocations << '\n';
+  std::cerr << "  Torn read retries:  " << stats.torn_read_retries << '\n';
+  if (!options.count_hardware_events) {
+    return;
+  }
+  if (!stats.hardware_counters_available) {
+    std::cerr << "Hardware counters unavailable (not permitted by "
+                 "/proc/sys/kernel/perf_event_paranoid, or no PMU)\n";
+    return;
+  }
+  std::cerr << "Hardware counters:\n";
+  std::cerr << "  Phase                  Cycles   Instructions    IPC   Cache misses  "
+               "Branch misses\n";
+  const std::pair<const char*, const HardwareCounters*> phases[] = {
+      {"Database", &stats.database_counters},
+      {"List crates", &stats.list_crates_counters},
+      {"Parse crates", &stats.parse_crates_counters},
+      {"Resolve tracks", &stats.resolve_counters},
+      {"Nest crates", &stats.nest_counters},
+  };
+  for (const auto& phase : phases) {
+    const HardwareCounters& c = *phase.second;
+    double ipc = c.cycles ? static_cast<double>(c.instructions) / c.cycles : 0;
+    char line[128];
+    snprintf(line, sizeof(line), "  %-14s %14llu %14llu %6.2f %14llu %14llu\n", phase.first,
+             static_cast<unsigned long long>(c.cycles),
+             static_cast<unsigned long long>(c.instructions), ipc,
+             static_cast<unsigned long long>(c.cache_misses),
+             static_cast<unsigned long long>(c.branch_misses));
+    std::cerr << line;
+  }
+}
+
+// Writes the trace collected by --trace, if any. Returns false if it couldn't be written.
+bool writeTrace(const std::string& path, const Tracer& tracer) {
+  if (path.empty()) {
+    return true;
+  }
+  std::ofstream out(path);
+  tracer.writeJson(out);
+  out.close();
+  if (!out) {
+    std::cerr << "Could not write trace to " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
 
 int main(int argc, char** argv) {
-  std::filesystem::path in_path;
-  if (argc <= 1) {
-    in_path = ".";
-  } else {
-    in_path = argv[1];
+  std::vector<std::string> in_paths;
+  Format format = Format::kText;
+  ReadOptions options;
+  LoadStats stats;
+  Tracer tracer;
+  std::string trace_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--match-normalized-paths") {
+      options.match_normalized_paths = true;
+    } else if (arg == "--stats") {
+      options.stats = &stats;
+    } else if (arg == "--perf") {
+      options.stats = &stats;
+      options.count_hardware_events = true;
+    } else if (arg.rfind("--trace=", 0) == 0) {
+      trace_path = arg.substr(strlen("--trace="));
+      options.tracer = &tracer;
+    } else if (arg.rfind("--format=", 0) == 0) {
+      std::string name = arg.substr(strlen("--format="));
+      if (name == "text") {
+        format = Format::kText;
+      } else if (name == "ndjson") {
+        format = Format::kNdjson;
+      } else if (name == "json") {
+        format = Format::kJson;
+      } else if (name == "csv") {
+        format = Format::kCsv;
+      } else {
+        std::cerr << "Unknown format " << name << '\n';
+        return 1;
+      }
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "Unknown flag " << arg << '\n';
+      return 1;
+    } else {
+      in_paths.push_back(arg);
+    }
   }
 
-  std::unique_ptr<Library> library = readLibrary(in_path.native());
+  if (in_paths.empty()) {
+    in_paths.push_back(".");
+  }
+  if (format != Format::kText) {
+    exportLibraries(in_paths, format, options);
+    printStats(options);
+    return writeTrace(trace_path, tracer) ? 0 : 1;
+  }
+
+  std::unique_ptr<Library> library;
+  if (in_paths.size() == 1) {
+    library = readLibrary(in_paths[0], options);
+  } else {
+    library = readLibraries(in_paths, options);
+  }
 
   std::cout << "Library contains " << library->tracks.size() << " tracks:\n";
   for (auto& track : library->tracks) {
@@ -34,4 +312,7 @@ int main(int argc, char** argv) {
       std::cout << "    Path: " << track->path << '\n';
     }
   }
+
+  printStats(options);
+  return writeTrace(trace_path, tracer) ? 0 : 1;
 }
@@ -0,0 +1,231 @@
+#include "daemon_protocol.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Usage:
+//   query_serato_daemon --socket=PATH crates
+//   query_serato_daemon --socket=PATH crate NAME
+//   query_serato_daemon --socket=PATH find TRACK_PATH
+//   query_serato_daemon --socket=PATH search [--prefix] [--limit=N] QUERY
+//   query_serato_daemon --socket=PATH watch
+// Asks a running serato_library_daemon about its library. crate and search print the paths of the
+// matching tracks; crates prints each crate's name (with subcrates as "Parent%%Child") and track
+// count. watch prints the library's version every time the daemon reloads it.
+
+namespace {
+
+class Client {
+public:
+  explicit Client(const std::string& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      throw std::runtime_error("Socket path is too long");
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+      throw std::runtime_error("Could not connect to " + socket_path + ": " + strerror(errno));
+    }
+  }
+
+  ~Client() {
+    close(fd_);
+  }
+
+  // Sends a request. The payload is filled in by write.
+  template <typename F>
+  void send(DaemonOp op, F write) {
+    std::string out;
+    FrameWriter frame(&out, ++last_request_id_, static_cast<uint8_t>(op));
+    write(frame);
+    frame.finish();
+    for (size_t sent = 0; sent < out.size();) {
+      ssize_t n = ::send(fd_, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        throw std::runtime_error("Lost connection to the daemon");
+      }
+      sent += n;
+    }
+  }
+
+  // Waits for the next frame. Throws if it's an error response. The returned frame's payload is
+  // valid until the next call.
+  Frame receive() {
+    buffer_.erase(0, consumed_);
+    consumed_ = 0;
+    Frame frame;
+    while (!(consumed_ = parseFrame(buffer_, &frame))) {
+      char chunk[64 * 1024];
+      ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        throw std::runtime_error("Lost connection to the daemon");
+      }
+      buffer_.append(chunk, n);
+    }
+    if (frame.type == static_cast<uint8_t>(DaemonStatus::kError)) {
+      throw std::runtime_error(std::string(PayloadReader(frame.payload).str()));
+    }
+    return frame;
+  }
+
+private:
+  int fd_;
+  uint32_t last_request_id_ = 0;
+  std::string buffer_;
+  size_t consumed_ = 0;
+};
+
+// Reads "u32 count, u32 position..." after the version at the start of a response.
+std::vector<uint32_t> readPositions(PayloadReader* in) {
+  std::vector<uint32_t> positions(in->u32());
+  for (uint32_t& pos : positions) {
+    pos = in->u32();
+  }
+  return positions;
+}
+
+// A reload between a query and the kGetTracks for its results makes us start over. Give up after
+// this many tries, in case the library is being rewritten continuously.
+const int kMaxQueryAttempts = 5;
+
+// Prints the paths of the tracks at positions in the given version of the library. Returns false
+// (having printed nothing) if the daemon has moved on to another version.
+bool printPaths(Client* client, uint64_t version, const std::vector<uint32_t>& positions) {
+  client->send(DaemonOp::kGetTracks, [&](FrameWriter& frame) {
+    frame.u64(version);
+    frame.u32(positions.size());
+    for (uint32_t pos : positions) {
+      frame.u32(pos);
+    }
+  });
+  Frame response = client->receive();
+  if (response.type == static_cast<uint8_t>(DaemonStatus::kVersionMismatch)) {
+    return false;
+  }
+  PayloadReader in(response.payload);
+  in.u64();
+  uint32_t count = in.u32();
+  for (uint32_t i = 0; i < count; i++) {
+    std::cout << in.str() << '\n';
+    for (int field = 0; field < 7; field++) {
+      in.str();
+    }
+    in.u32();
+  }
+  return true;
+}
+
+// Runs query, which sends a request and returns the version and positions from its response, and
+// prints the resulting tracks' paths, starting over if the library is reloaded in between.
+template <typename F>
+void queryPaths(Client* client, F query) {
+  for (int attempt = 1; ; attempt++) {
+    std::vector<uint32_t> positions;
+    uint64_t version = query(&positions);
+    if (printPaths(client, version, positions)) {
+      return;
+    }
+    if (attempt == kMaxQueryAttempts) {
+      throw std::runtime_error("The library kept changing; try again later");
+    }
+  }
+}
+
+int usage() {
+  std::cerr << "Usage: query_serato_daemon --socket=PATH "
+               "crates|crate NAME|find PATH|search [--prefix] [--limit=N] QUERY|watch\n";
+  return 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string socket_path;
+  bool prefix_only = false;
+  uint32_t limit = UINT32_MAX;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--socket=", 0) == 0) {
+      socket_path = arg.substr(strlen("--socket="));
+    } else if (arg == "--prefix") {
+      prefix_only = true;
+    } else if (arg.rfind("--limit=", 0) == 0) {
+      limit = std::stoul(arg.substr(strlen("--limit=")));
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (socket_path.empty() || args.empty()) {
+    return usage();
+  }
+  const std::string& command = args[0];
+
+  try {
+    Client client(socket_path);
+    if (command == "crates" && args.size() == 1) {
+      client.send(DaemonOp::kListCrates, [](FrameWriter&) {});
+      PayloadReader in(client.receive().payload);
+      in.u64();
+      uint32_t count = in.u32();
+      for (uint32_t i = 0; i < count; i++) {
+        std::string_view name = in.str();
+        std::cout << name << '\t' << in.u32() << '\n';
+      }
+    } else if (command == "crate" && args.size() == 2) {
+      queryPaths(&client, [&](std::vector<uint32_t>* positions) {
+        client.send(DaemonOp::kCrateTracks, [&](FrameWriter& frame) { frame.str(args[1]); });
+        PayloadReader in(client.receive().payload);
+        uint64_t version = in.u64();
+        *positions = readPositions(&in);
+        return version;
+      });
+    } else if (command == "find" && args.size() == 2) {
+      client.send(DaemonOp::kFindPath, [&](FrameWriter& frame) { frame.str(args[1]); });
+      PayloadReader in(client.receive().payload);
+      in.u64();
+      uint32_t pos = in.u32();
+      if (pos == kNoPosition) {
+        std::cerr << "Not found\n";
+        return 1;
+      }
+      std::cout << pos << '\n';
+    } else if (command == "search" && args.size() == 2) {
+      uint32_t total = 0;
+      size_t shown = 0;
+      queryPaths(&client, [&](std::vector<uint32_t>* positions) {
+        client.send(DaemonOp::kSearch, [&](FrameWriter& frame) {
+          frame.u8(prefix_only);
+          frame.str(args[1]);
+          frame.u32(limit);
+        });
+        PayloadReader in(client.receive().payload);
+        uint64_t version = in.u64();
+        total = in.u32();
+        *positions = readPositions(&in);
+        shown = positions->size();
+        return version;
+      });
+      if (total > shown) {
+        std::cerr << total << " matches, showing " << shown << '\n';
+      }
+    } else if (command == "watch" && args.size() == 1) {
+      client.send(DaemonOp::kSubscribe, [](FrameWriter&) {});
+      std::cout << "Version " << PayloadReader(client.receive().payload).u64() << std::endl;
+      while (true) {
+        std::cout << "Version " << PayloadReader(client.receive().payload).u64() << std::endl;
+      }
+    } else {
+      return usage();
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
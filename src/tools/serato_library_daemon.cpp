@@ -0,0 +1,467 @@
+#include "daemon_protocol.h"
+#include "library_holder.h"
+#include "search_index.h"
+#include "seratocrates.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Usage:
+//   serato_library_daemon --socket=PATH [--match-normalized-paths] [path]
+// Loads the Serato library at path (defaults to current directory), keeps it in memory, and
+// answers queries about it on a Unix socket at PATH. See daemon_protocol.h for the protocol and
+// query_serato_daemon for a client.
+//
+// The library is reloaded whenever something in its _Serato_ or Subcrates folder changes, and
+// clients that subscribed are told about the new version. Requests are answered from whichever
+// version was current when they arrived; a reload never blocks them.
+//
+// --match-normalized-paths: see ReadOptions::match_normalized_paths.
+
+namespace {
+
+// After a change, wait until the library's files have been quiet for this long before reloading,
+// since Serato rewrites several files at once.
+const int kReloadQuietMillis = 300;
+const size_t kReadBufferBytes = 64 * 1024;
+// Responses wait for a connection's queue to drop below this, and a subscriber whose events would
+// push it past this is disconnected.
+const size_t kMaxQueuedBytes = 1 << 20;
+
+// Everything needed to answer requests against one version of the library. Immutable once built.
+struct Snapshot {
+  explicit Snapshot(ImmutableLibrary library_in)
+      : library(std::move(library_in)), search(*library) {
+    for (uint32_t i = 0; i < library->tracks.size(); i++) {
+      positions.emplace(library->tracks[i].get(), i);
+      path_positions[library->tracks[i]->path] = i;
+    }
+    for (const Crate& crate : library->crates) {
+      addCrate(crate, "");
+    }
+  }
+
+  void addCrate(const Crate& crate, const std::string& prefix) {
+    std::string name = prefix.empty() ? crate.name : prefix + "%%" + crate.name;
+    std::vector<uint32_t> tracks;
+    for (const std::shared_ptr<Track>& track : crate.tracks) {
+      tracks.push_back(positions.at(track.get()));
+    }
+    crate_index.emplace(name, crates.size());
+    crates.emplace_back(name, std::move(tracks));
+    for (const Crate& subcrate : crate.subcrates) {
+      addCrate(subcrate, name);
+    }
+  }
+
+  ImmutableLibrary library;
+  SearchIndex search;
+  std::unordered_map<const Track*, uint32_t> positions;
+  std::unordered_map<std::string, uint32_t> path_positions;
+  // Every crate, parents before their subcrates, with the positions of its tracks.
+  std::vector<std::pair<std::string, std::vector<uint32_t>>> crates;
+  std::unordered_map<std::string, size_t> crate_index;
+};
+
+std::shared_ptr<const Snapshot> current_snapshot;
+
+// Writes all of data to fd. Returns false if the connection has gone away.
+bool sendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+// A client connection. Everything sent on it goes through a queue that its writer thread drains,
+// so that the reload thread never waits on a client: a subscriber that stops reading is
+// disconnected once its events back up past kMaxQueuedBytes. Responses instead wait for room in
+// the queue, which only holds up that client's own requests.
+struct Connection {
+  explicit Connection(int fd) : fd(fd) {}
+  ~Connection() {
+    close(fd);
+  }
+
+  // Queues data, waiting while the queue is full. Returns false if the connection is closed.
+  bool send(const std::string& data) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]() { return closed || queued.size() < kMaxQueuedBytes; });
+    if (closed) {
+      return false;
+    }
+    queued += data;
+    changed.notify_all();
+    return true;
+  }
+
+  // Starts sending events for versions after version, which the client already knows about.
+  void subscribe(uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    subscribed = true;
+    event_version = std::max(event_version, version);
+  }
+
+  // Queues an event for version, unless the connection isn't subscribed or already had one for it.
+  // Never waits.
+  void sendEvent(uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!subscribed || closed || version <= event_version) {
+      return;
+    }
+    event_version = version;
+    if (queued.size() >= kMaxQueuedBytes) {
+      std::cerr << "Disconnecting a subscriber that isn't reading its events\n";
+      closeLocked();
+      return;
+    }
+    FrameWriter frame(&queued, 0, static_cast<uint8_t>(DaemonStatus::kEvent));
+    frame.u64(version);
+    frame.finish();
+    changed.notify_all();
+  }
+
+  // Closes the connection once everything queued has been sent.
+  void finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    finishing = true;
+    changed.notify_all();
+  }
+
+  // Runs on the connection's writer thread until the connection is closed.
+  void writeQueued() {
+    std::string writing;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return closed || finishing || !queued.empty(); });
+        if (closed || queued.empty()) {
+          closeLocked();
+          return;
+        }
+        writing.swap(queued);
+        changed.notify_all();
+      }
+      if (!sendAll(fd, writing)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        closeLocked();
+        return;
+      }
+      writing.clear();
+    }
+  }
+
+  // Must be called with mutex held. Shutting the socket down wakes up the threads blocked on it.
+  void closeLocked() {
+    if (!closed) {
+      closed = true;
+      shutdown(fd, SHUT_RDWR);
+      changed.notify_all();
+    }
+  }
+
+  int fd;
+  std::mutex mutex;
+  // Signalled when queued, closed or finishing change.
+  std::condition_variable changed;
+  std::string queued;
+  bool closed = false;
+  bool finishing = false;
+  bool subscribed = false;
+  // The newest version the client has been told about.
+  uint64_t event_version = 0;
+};
+
+std::mutex connections_mutex;
+std::vector<std::weak_ptr<Connection>> connections;
+
+// Queues an event with the new version on every subscribed connection.
+void notifySubscribers(uint64_t version) {
+  std::vector<std::shared_ptr<Connection>> live;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    auto gone = std::remove_if(connections.begin(), connections.end(),
+                               [](const std::weak_ptr<Connection>& c) { return c.expired(); });
+    connections.erase(gone, connections.end());
+    for (const std::weak_ptr<Connection>& weak : connections) {
+      if (std::shared_ptr<Connection> connection = weak.lock()) {
+        live.push_back(std::move(connection));
+      }
+    }
+  }
+  for (const std::shared_ptr<Connection>& connection : live) {
+    connection->sendEvent(version);
+  }
+}
+
+// Appends the response to one request to out. Sets *subscribe if it was a kSubscribe.
+void handleRequest(const Snapshot& snapshot, const Frame& request, std::string* out,
+                   bool* subscribe) {
+  size_t start = out->size();
+  try {
+    PayloadReader in(request.payload);
+    FrameWriter frame(out, request.request_id, static_cast<uint8_t>(DaemonStatus::kOk));
+    frame.u64(snapshot.library.version());
+    const std::vector<std::shared_ptr<Track>>& tracks = snapshot.library->tracks;
+
+    switch (static_cast<DaemonOp>(request.type)) {
+      case DaemonOp::kListCrates:
+        frame.u32(snapshot.crates.size());
+        for (const auto& crate : snapshot.crates) {
+          frame.str(crate.first);
+          frame.u32(crate.second.size());
+        }
+        break;
+
+      case DaemonOp::kCrateTracks: {
+        auto it = snapshot.crate_index.find(std::string(in.str()));
+        if (it == snapshot.crate_index.end()) {
+          throw ProtocolError("No such crate");
+        }
+        const std::vector<uint32_t>& positions = snapshot.crates[it->second].second;
+        frame.u32(positions.size());
+        for (uint32_t pos : positions) {
+          frame.u32(pos);
+        }
+        break;
+      }
+
+      case DaemonOp::kGetTracks: {
+        uint64_t version = in.u64();
+        if (version != snapshot.library.version()) {
+          out->resize(start);
+          FrameWriter mismatch(out, request.request_id,
+                               static_cast<uint8_t>(DaemonStatus::kVersionMismatch));
+          mismatch.u64(snapshot.library.version());
+          mismatch.finish();
+          return;
+        }
+        uint32_t count = in.u32();
+        frame.u32(count);
+        for (uint32_t i = 0; i < count; i++) {
+          uint32_t pos = in.u32();
+          if (pos >= tracks.size()) {
+            throw ProtocolError("Track position out of range");
+          }
+          const Track& track = *tracks[pos];
+          for (const std::string* field : {&track.path, &track.title, &track.artist, &track.album,
+                                           &track.comment, &track.bpm, &track.key,
+                                           &track.length}) {
+            frame.str(*field);
+          }
+          frame.u32(track.date_added);
+        }
+        break;
+      }
+
+      case DaemonOp::kFindPath: {
+        auto it = snapshot.path_positions.find(std::string(in.str()));
+        frame.u32(it == snapshot.path_positions.end() ? kNoPosition : it->second);
+        break;
+      }
+
+      case DaemonOp::kSearch: {
+        bool prefix_only = in.u8() != 0;
+        std::string query(in.str());
+        uint32_t limit = in.u32();
+        std::vector<size_t> matches =
+            prefix_only ? snapshot.search.findPrefix(query) : snapshot.search.find(query);
+        size_t count = std::min<size_t>(matches.size(), limit);
+        frame.u32(matches.size());
+        frame.u32(count);
+        for (size_t i = 0; i < count; i++) {
+          frame.u32(matches[i]);
+        }
+        break;
+      }
+
+      case DaemonOp::kSubscribe:
+        *subscribe = true;
+        break;
+
+      case DaemonOp::kVersion:
+        frame.u32(tracks.size());
+        break;
+
+      default:
+        throw ProtocolError("Unknown request type");
+    }
+    frame.finish();
+  } catch (const ProtocolError& e) {
+    out->resize(start);
+    FrameWriter frame(out, request.request_id, static_cast<uint8_t>(DaemonStatus::kError));
+    frame.str(e.what());
+    frame.finish();
+  }
+}
+
+// Serves one connection until the client closes it or breaks the protocol. Each call to read
+// may pick up several pipelined requests; their responses are queued together.
+void serveRequests(Connection* connection) {
+  std::string buffer;
+  std::string out;
+  char chunk[kReadBufferBytes];
+  while (true) {
+    ssize_t n = recv(connection->fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    buffer.append(chunk, n);
+
+    std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current_snapshot);
+    size_t consumed = 0;
+    bool subscribe = false;
+    out.clear();
+    try {
+      Frame request;
+      while (size_t size = parseFrame(std::string_view(buffer).substr(consumed), &request)) {
+        handleRequest(*snapshot, request, &out, &subscribe);
+        consumed += size;
+      }
+    } catch (const ProtocolError& e) {
+      std::cerr << "Closing connection: " << e.what() << '\n';
+      return;
+    }
+    buffer.erase(0, consumed);
+    if (!out.empty() && !connection->send(out)) {
+      return;
+    }
+    if (subscribe) {
+      // Events only start after the kSubscribe response, which told the client about the
+      // snapshot's version. If there has been a reload since, notifySubscribers may already have
+      // skipped this connection, so catch it up here.
+      connection->subscribe(snapshot->library.version());
+      connection->sendEvent(std::atomic_load(&current_snapshot)->library.version());
+    }
+  }
+}
+
+void serve(std::shared_ptr<Connection> connection) {
+  serveRequests(connection.get());
+  connection->finish();
+}
+
+// Reloads the library whenever its files change. Runs forever.
+void watchLibrary(const std::string& path, const ReadOptions& options, LibraryHolder* holder) {
+  int inotify = inotify_init1(IN_CLOEXEC);
+  if (inotify < 0) {
+    std::cerr << "Could not watch the library for changes; it won't be reloaded\n";
+    return;
+  }
+  std::filesystem::path serato_dir = std::filesystem::path(path) / "_Serato_";
+  const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+  inotify_add_watch(inotify, serato_dir.c_str(), mask);
+  inotify_add_watch(inotify, (serato_dir / "Subcrates").c_str(), mask);
+
+  char events[4096];
+  while (true) {
+    // Block until something changes, then drain events until things are quiet.
+    pollfd fd{inotify, POLLIN, 0};
+    int timeout = -1;
+    while (poll(&fd, 1, timeout) > 0) {
+      if (read(inotify, events, sizeof(events)) < 0 && errno != EINTR) {
+        return;
+      }
+      timeout = kReloadQuietMillis;
+    }
+
+    try {
+      ImmutableLibrary library = holder->reload(path, options);
+      std::atomic_store(&current_snapshot,
+                        std::shared_ptr<const Snapshot>(std::make_shared<Snapshot>(library)));
+      std::cerr << "Reloaded library (version " << library.version() << ", "
+                << library->tracks.size() << " tracks)\n";
+      notifySubscribers(library.version());
+    } catch (const std::exception& e) {
+      // Not just ReadException: listing the crates can throw filesystem_error if Serato is
+      // rewriting the Subcrates directory, and anything escaping this thread ends the daemon.
+      std::cerr << "Reload failed, keeping the previous version: " << e.what() << '\n';
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string library_path = ".";
+  std::string socket_path;
+  ReadOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--match-normalized-paths") {
+      options.match_normalized_paths = true;
+    } else if (arg.rfind("--socket=", 0) == 0) {
+      socket_path = arg.substr(strlen("--socket="));
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "Unknown flag " << arg << '\n';
+      return 1;
+    } else {
+      library_path = arg;
+    }
+  }
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Usage: serato_library_daemon --socket=PATH [path]\n";
+    return 1;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+
+  LibraryHolder holder;
+  ImmutableLibrary library = holder.reload(library_path, options);
+  std::atomic_store(&current_snapshot,
+                    std::shared_ptr<const Snapshot>(std::make_shared<Snapshot>(library)));
+  std::cerr << "Loaded library (" << library->tracks.size() << " tracks)\n";
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(socket_path.c_str());
+  if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+      || listen(listener, SOMAXCONN) != 0) {
+    std::cerr << "Could not listen on " << socket_path << ": " << strerror(errno) << '\n';
+    return 1;
+  }
+
+  std::thread(watchLibrary, library_path, options, &holder).detach();
+
+  while (true) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "accept failed: " << strerror(errno) << '\n';
+      return 1;
+    }
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      connections.push_back(connection);
+    }
+    std::thread([connection]() { connection->writeQueued(); }).detach();
+    std::thread(serve, std::move(connection)).detach();
+  }
+}
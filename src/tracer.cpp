@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "tracer.h"
+
+namespace {
+
+std::atomic<uint64_t> next_tracer_id{1};
+
+// Writes s as a JSON string literal.
+void writeJsonString(std::ostream& out, const std::string& s) {
+  out << '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out << escaped;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// Trace-event timestamps are in microseconds.
+void writeMicros(std::ostream& out, int64_t nanos) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.3f", nanos / 1000.0);
+  out << text;
+}
+
+}  // namespace
+
+Tracer::Tracer(size_t events_per_thread)
+    : events_per_thread_(std::max<size_t>(events_per_thread, 1)),
+      epoch_(std::chrono::steady_clock::now()),
+      id_(next_tracer_id++) {}
+
+Tracer::~Tracer() = default;
+
+Tracer::ThreadBuffer* Tracer::buffer() {
+  // Each thread remembers the buffer it used last, so the search below only runs when a thread
+  // first records into a Tracer (or switches between Tracers).
+  thread_local uint64_t cached_id = 0;
+  thread_local ThreadBuffer* cached_buffer = nullptr;
+  if (cached_id == id_) {
+    return cached_buffer;
+  }
+
+  // Thread ids can be reused once a thread exits, in which case the new thread takes over the old
+  // one's buffer (and row in the timeline). Their spans can't overlap, so that's harmless, and it
+  // keeps the number of buffers bounded when threads come and go (as parallelFor's do).
+  std::thread::id thread = std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(buffers_mutex_);
+  auto it = std::find_if(
+      buffers_.begin(), buffers_.end(),
+      [&](const std::unique_ptr<ThreadBuffer>& b) { return b->thread == thread; });
+  if (it == buffers_.end()) {
+    std::unique_ptr<ThreadBuffer> created = std::make_unique<ThreadBuffer>();
+    created->thread = thread;
+    created->tid = buffers_.size() + 1;
+    buffers_.push_back(std::move(created));
+    it = buffers_.end() - 1;
+  }
+  cached_id = id_;
+  cached_buffer = it->get();
+  return cached_buffer;
+}
+
+void Tracer::record(const char* name, const std::string* detail, int64_t start, int64_t end) {
+  ThreadBuffer* b = buffer();
+  std::lock_guard<std::mutex> lock(b->mutex);
+  Event* event;
+  if (b->events.size() < events_per_thread_) {
+    event = &b->events.emplace_back();
+  } else {
+    event = &b->events[b->next];
+    b->next = (b->next + 1) % events_per_thread_;
+  }
+  event->name = name;
+  if (detail) {
+    event->detail.assign(*detail);
+  } else {
+    event->detail.clear();
+  }
+  event->start = start;
+  event->end = end;
+}
+
+void Tracer::writeJson(std::ostream& out) const {
+  std::vector<ThreadBuffer*> buffers;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    for (const std::unique_ptr<ThreadBuffer>& b : buffers_) {
+      buffers.push_back(b.get());
+    }
+  }
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  const char* separator = "\n";
+  for (ThreadBuffer* b : buffers) {
+    out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+        << ",\"args\":{\"name\":\"thread " << b->tid << "\"}}";
+    separator = ",\n";
+
+    std::lock_guard<std::mutex> lock(b->mutex);
+    // Once the ring has wrapped, the oldest event is at next.
+    for (size_t i = 0; i < b->events.size(); i++) {
+      const Event& event = b->events[(b->next + i) % b->events.size()];
+      out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"seratocrates\",\"ph\":\"X\","
+          << "\"pid\":1,\"tid\":" << b->tid << ",\"ts\":";
+      writeMicros(out, event.start);
+      out << ",\"dur\":";
+      writeMicros(out, event.end - event.start);
+      if (!event.detail.empty()) {
+        out << ",\"args\":{\"detail\":";
+        writeJsonString(out, event.detail);
+        out << '}';
+      }
+      out << '}';
+    }
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,108 @@
+// This file contains Tracer, which records a timeline of what each thread did during loads.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A Tracer records a span for each step of a load (opening, reading and parsing each file,
+// resolving crate tracks, nesting crates, and each chunk of the parallel database parse) and
+// writes them out as Chrome trace-event JSON, which chrome://tracing and Perfetto
+// (ui.perfetto.dev) can display as a per-thread timeline. Pass one in ReadOptions::tracer; the
+// same Tracer can be used for many loads, including concurrent ones.
+//
+// Each thread records into its own fixed-size ring buffer, so recording a span doesn't contend
+// with other threads, and a long-running process (e.g. one that reloads in the background) only
+// keeps the most recent events_per_thread spans of each thread.
+class Tracer {
+public:
+  explicit Tracer(size_t events_per_thread = 1 << 16);
+  ~Tracer();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  // Writes the recorded spans as a JSON object in Chrome's trace-event format. Safe to call while
+  // other threads are still recording.
+  void writeJson(std::ostream& out) const;
+
+private:
+  friend class TraceSpan;
+
+  struct Event {
+    const char* name;
+    std::string detail;
+    // Nanoseconds since the Tracer was created.
+    int64_t start;
+    int64_t end;
+  };
+
+  struct ThreadBuffer {
+    std::thread::id thread;
+    // Numbers threads in the order they first recorded a span.
+    uint32_t tid;
+    // Guards events and next, which writeJson reads from another thread. It's uncontended except
+    // while writeJson runs.
+    std::mutex mutex;
+    std::vector<Event> events;
+    // Where the next event goes once events is full.
+    size_t next = 0;
+  };
+
+  // Returns the calling thread's buffer, creating it the first time.
+  ThreadBuffer* buffer();
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch_).count();
+  }
+
+  void record(const char* name, const std::string* detail, int64_t start, int64_t end);
+
+  const size_t events_per_thread_;
+  const std::chrono::steady_clock::time_point epoch_;
+  // Distinguishes this Tracer from others (including earlier ones at the same address) in each
+  // thread's cached buffer lookup.
+  const uint64_t id_;
+
+  mutable std::mutex buffers_mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+// Records a span from its construction to its destruction. Does nothing (not even reading the
+// clock) if tracer is null. name must be a string literal (or otherwise outlive the Tracer).
+// detail, if given, is shown as the span's "detail" argument (e.g. a file's path); it must outlive
+// the span, and is copied when the span ends.
+class TraceSpan {
+public:
+  TraceSpan(Tracer* tracer, const char* name) : tracer_(tracer), name_(name) {
+    if (tracer_) {
+      start_ = tracer_->now();
+    }
+  }
+
+  TraceSpan(Tracer* tracer, const char* name, const std::string& detail)
+      : TraceSpan(tracer, name) {
+    detail_ = tracer_ ? &detail : nullptr;
+  }
+
+  ~TraceSpan() {
+    if (tracer_) {
+      tracer_->record(name_, detail_, start_, tracer_->now());
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  Tracer* tracer_;
+  const char* name_;
+  const std::string* detail_ = nullptr;
+  int64_t start_ = 0;
+};
@@ -0,0 +1,268 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "batch_read.h"
+#include "read_disk_files.h"
+#include "track_cache.h"
+#include "track_index.h"
+
+namespace {
+
+const uint32_t kEmptySlot = UINT32_MAX;
+
+// Where a track's otrk record payload is in the database, and the hash of its path. Offsets are
+// 32 bits to keep this at 16 bytes; record sizes are 32 bits on disk anyway.
+struct TrackEntry {
+  uint64_t path_hash;
+  uint32_t pos;
+  uint32_t size;
+};
+
+// Estimated heap bytes for a decoded track, including the shared_ptr control block.
+size_t trackBytes(const Track& track) {
+  // The capacity of the small string buffer (15 in libstdc++, whose strings are 32 bytes).
+  static const size_t kSmallStringCapacity = std::string().capacity();
+  size_t ret = sizeof(Track) + 2 * sizeof(void*);
+  for (const std::string* field : {&track.path, &track.title, &track.artist, &track.album,
+                                   &track.comment, &track.bpm, &track.key, &track.length}) {
+    // Strings that fit in the small string buffer don't allocate.
+    if (field->capacity() > kSmallStringCapacity) {
+      ret += field->capacity() + 1;
+    }
+  }
+  return ret;
+}
+
+// Returns the path in the otrk record payload at ctx->pos, leaving ctx->pos unchanged.
+std::string trackPath(ReadContext ctx, size_t record_size) {
+  // The caller reports progress for the whole record.
+  ctx.progress = nullptr;
+  size_t end = ctx.pos + record_size;
+  std::string tag;
+  std::string path;
+  while (ctx.pos < end) {
+    size_t field_size = 0;
+    readRecordHeader(&ctx, &tag, &field_size);
+    if (tag == "pfil") {
+      read<std::string>(&ctx, field_size, &path);
+      break;
+    }
+    skipRecord(&ctx, field_size);
+  }
+  return path;
+}
+
+}  // namespace
+
+
+struct TrackCache::Impl {
+  Impl(const std::string& database_path, size_t budget_bytes)
+      : path(database_path), budget_bytes(budget_bytes) {}
+
+  ~Impl() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  // Reads the pos'th track's record from the file and decodes it. Throws ReadException if the
+  // file has changed since it was indexed, since the index's offsets no longer mean anything.
+  // Only uses state that's fixed after construction, so it doesn't need the lock.
+  std::shared_ptr<const Track> decode(size_t pos) {
+    const TrackEntry& entry = entries[pos];
+    std::string record(entry.size, '\0');
+    size_t got = 0;
+    while (got < record.size()) {
+      ssize_t n = pread(fd, &record[got], record.size() - got, entry.pos + got);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      got += n;
+    }
+    // Checking after the read also catches a rewrite that was in progress during it.
+    if (got != record.size() || fileVersion(fd) != version) {
+      throw ReadException("File at path " + path + " changed since it was indexed");
+    }
+    ReadContext ctx{record.data(), record.size(), 0, nullptr};
+    std::shared_ptr<Track> ret = std::make_shared<Track>();
+    read<Track>(&ctx, entry.size, ret.get());
+    return ret;
+  }
+
+  // Must be called without mutex held.
+  std::shared_ptr<const Track> get(size_t pos) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = cached.find(pos);
+      if (it != cached.end()) {
+        stats.hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->track;
+      }
+      stats.misses++;
+    }
+
+    // Read and decode without the lock, so that hits on other threads don't wait for the disk.
+    std::shared_ptr<const Track> track = decode(pos);
+    size_t bytes = trackBytes(*track);
+    std::lock_guard<std::mutex> lock(mutex);
+    // Another thread may have decoded the same track in the meantime.
+    auto it = cached.find(pos);
+    if (it != cached.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->track;
+    }
+    lru.push_front(Cached{pos, track, bytes});
+    cached.emplace(pos, lru.begin());
+    stats.cached_bytes += bytes;
+    // Evict least recently used tracks until we're within budget, but always keep the track
+    // we're returning.
+    while (stats.cached_bytes > budget_bytes && lru.size() > 1) {
+      const Cached& victim = lru.back();
+      stats.cached_bytes -= victim.bytes;
+      stats.evictions++;
+      cached.erase(victim.pos);
+      lru.pop_back();
+    }
+    stats.cached_tracks = lru.size();
+    return track;
+  }
+
+  struct Cached {
+    size_t pos;
+    std::shared_ptr<const Track> track;
+    size_t bytes;
+  };
+
+  std::string path;
+  // The database, kept open so that renaming a new file over it doesn't affect us, and its version
+  // when it was indexed.
+  int fd = -1;
+  FileVersion version;
+  std::vector<TrackEntry> entries;
+  // Open-addressing table (with linear probing) of positions in entries, keyed by path hash.
+  std::vector<uint32_t> slots;
+  size_t mask = 0;
+
+  size_t budget_bytes;
+  // Guards everything below.
+  std::mutex mutex;
+  std::list<Cached> lru;
+  std::unordered_map<size_t, std::list<Cached>::iterator> cached;
+  TrackCacheStats stats;
+};
+
+
+TrackCache::TrackCache(const std::string& path, size_t budget_bytes, const ReadOptions& options)
+    : impl_(std::make_unique<Impl>(
+          (std::filesystem::path(path) / "_Serato_" / "database V2").native(), budget_bytes)) {
+  const std::string& database_path = impl_->path;
+  // Index a private copy of the database, then open the file for reading tracks on demand. If it
+  // was rewritten in between, the index doesn't describe what we opened, so start over.
+  std::string database;
+  for (int attempt = 1; ; attempt++) {
+    database = readFile(database_path, options, &impl_->version);
+    impl_->fd = open(database_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (impl_->fd < 0) {
+      throw ReadException("Could not open file at path " + database_path);
+    }
+    if (fileVersion(impl_->fd) == impl_->version) {
+      break;
+    }
+    close(impl_->fd);
+    impl_->fd = -1;
+    if (attempt == kMaxReadAttempts) {
+      throw ReadException(
+          "File at path " + database_path + " kept changing while it was being read");
+    }
+    if (options.stats) {
+      options.stats->torn_read_retries++;
+    }
+  }
+  if (database.size() > UINT32_MAX) {
+    throw ReadException("Database is too large to index");
+  }
+  ReadContext ctx{database.data(), database.size(), 0, options.stats};
+  ctx.progress = options.progress;
+  if (options.progress) {
+    options.progress->bytes_total += database.size();
+  }
+  if (options.stats) {
+    options.stats->bytes_read += database.size();
+  }
+
+  std::string tag;
+  while (ctx.pos < ctx.size) {
+    size_t record_size = 0;
+    readRecordHeader(&ctx, &tag, &record_size);
+    if (tag == "otrk") {
+      if (ctx.size - ctx.pos < record_size) {
+        throw ReadException("File was truncated when reading track");
+      }
+      impl_->entries.push_back(TrackEntry{
+          hashPath(trackPath(ctx, record_size)), static_cast<uint32_t>(ctx.pos),
+          static_cast<uint32_t>(record_size)});
+    }
+    skipRecord(&ctx, record_size);
+  }
+  if (ctx.progress) {
+    reportProgress(&ctx);
+  }
+  impl_->entries.shrink_to_fit();
+
+  size_t capacity = 16;
+  // Keep the load factor at or below 1/2 so that probe sequences stay short.
+  while (capacity < impl_->entries.size() * 2) {
+    capacity <<= 1;
+  }
+  impl_->slots.assign(capacity, kEmptySlot);
+  impl_->mask = capacity - 1;
+  for (uint32_t i = 0; i < impl_->entries.size(); i++) {
+    size_t slot = impl_->entries[i].path_hash & impl_->mask;
+    while (impl_->slots[slot] != kEmptySlot) {
+      slot = (slot + 1) & impl_->mask;
+    }
+    impl_->slots[slot] = i;
+  }
+  impl_->stats.index_bytes = impl_->entries.capacity() * sizeof(TrackEntry)
+      + impl_->slots.capacity() * sizeof(uint32_t);
+}
+
+TrackCache::~TrackCache() = default;
+
+size_t TrackCache::size() const {
+  return impl_->entries.size();
+}
+
+std::shared_ptr<const Track> TrackCache::track(size_t pos) {
+  return impl_->get(pos);
+}
+
+size_t TrackCache::find(const std::string& path) {
+  uint64_t hash = hashPath(path);
+  // The index doesn't change after construction, so only get() needs the lock.
+  // If the database lists a path more than once, the last one wins, as in TrackIndex.
+  size_t ret = kNotFound;
+  for (size_t slot = hash & impl_->mask; impl_->slots[slot] != kEmptySlot;
+       slot = (slot + 1) & impl_->mask) {
+    uint32_t pos = impl_->slots[slot];
+    if (impl_->entries[pos].path_hash == hash && impl_->get(pos)->path == path) {
+      ret = ret == kNotFound ? pos : std::max<size_t>(ret, pos);
+    }
+  }
+  return ret;
+}
+
+TrackCacheStats TrackCache::stats() const {
+  std::lock_guard<std::mutex> lock(impl_->mutex);
+  return impl_->stats;
+}
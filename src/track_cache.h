@@ -0,0 +1,60 @@
+// This file contains TrackCache, for looking up tracks without decoding the whole database.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "seratocrates.h"
+
+struct TrackCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  // Estimated heap bytes held by the tracks currently in the cache.
+  size_t cached_bytes = 0;
+  size_t cached_tracks = 0;
+  // Bytes held by the index, which is always resident.
+  size_t index_bytes = 0;
+};
+
+// TrackCache is an alternative to readLibrary for devices that can't afford to keep every track
+// decoded. It reads "database V2" once to build a compact index (where each track's record is,
+// and a hash of its path), then keeps only the index and an open handle to the file. Tracks are
+// read and decoded when they're asked for and kept in an LRU cache bounded by a byte budget;
+// evicted tracks are read again on their next use.
+//
+// Serato rewrites the database in place, after which the index no longer matches the file. The
+// file's version is checked whenever a track is read, and track() and find() throw ReadException
+// if it has changed; make a new TrackCache to pick up the new database.
+//
+// All methods are safe to call from several threads at once.
+class TrackCache {
+public:
+  static constexpr size_t kNotFound = SIZE_MAX;
+
+  // path is as for readLibrary. budget_bytes bounds the estimated heap memory of cached tracks.
+  // options.stats and options.progress apply to building the index.
+  TrackCache(const std::string& path, size_t budget_bytes,
+             const ReadOptions& options = ReadOptions());
+  ~TrackCache();
+
+  // Number of tracks in the database.
+  size_t size() const;
+
+  // Returns the pos'th track in the database (in the same order as Library::tracks), where pos is
+  // less than size(). The returned track stays valid for as long as the caller holds it, even if
+  // it's evicted meanwhile. Throws ReadException if the track has to be read and the database has
+  // changed since it was indexed.
+  std::shared_ptr<const Track> track(size_t pos);
+
+  // Returns the position of the track with the given path, or kNotFound. Only tracks whose path
+  // hash matches are decoded. Throws ReadException as track() does.
+  size_t find(const std::string& path);
+
+  TrackCacheStats stats() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
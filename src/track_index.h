@@ -0,0 +1,121 @@
+// This file contains TrackIndex, which maps track paths to tracks.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "seratocrates.h"
+
+// 64-bit FNV-1a. It's simple, has no alignment requirements, and is good enough for paths.
+inline uint64_t hashPath(std::string_view path) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : path) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// TrackIndex is an open-addressing hash table (with linear probing) from Track::path to the
+// track's position in the library's track list. It doesn't copy any paths: keys are compared
+// against the Track::path strings that the library already owns, so the track list passed to the
+// constructor must outlive the index and must not be modified while the index is in use.
+//
+// A TrackIndex can also be built over a list of alternative keys (e.g. normalized paths), one per
+// track, in which case the same lifetime rules apply to that list.
+//
+// Each slot stores the full hash of its key, so almost all non-matching slots are rejected
+// without touching the path bytes.
+class TrackIndex {
+public:
+  static constexpr size_t kNotFound = SIZE_MAX;
+
+  explicit TrackIndex(const std::vector<std::shared_ptr<Track>>& tracks) : tracks_(&tracks) {
+    build(tracks.size());
+  }
+
+  // keys[i] is the key for the i'th track.
+  explicit TrackIndex(const std::vector<std::string>& keys) : keys_(&keys) {
+    build(keys.size());
+  }
+
+  // Returns the position in the track list of the track with the given path, or kNotFound.
+  size_t find(std::string_view path) const {
+    return find(path, hashPath(path));
+  }
+
+  // Same as above, for callers that already have hashPath(path).
+  size_t find(std::string_view path, uint64_t hash) const {
+    for (size_t i = hash & mask_; ; i = (i + 1) & mask_) {
+      const Slot& slot = slots_[i];
+      if (slot.track == kEmpty) {
+        return kNotFound;
+      }
+      if (slot.hash == hash && keyAt(slot.track) == path) {
+        return slot.track;
+      }
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+
+  struct Slot {
+    uint64_t hash = 0;
+    uint32_t track = kEmpty;
+  };
+
+  void build(size_t count) {
+    size_t capacity = 16;
+    // Keep the load factor at or below 1/2 so that probe sequences stay short.
+    while (capacity < count * 2) {
+      capacity <<= 1;
+    }
+    slots_.resize(capacity);
+    mask_ = capacity - 1;
+
+    for (size_t i = 0; i < count; i++) {
+      insert(i);
+    }
+  }
+
+  std::string_view keyAt(size_t track) const {
+    if (tracks_) {
+      return (*tracks_)[track]->path;
+    }
+    return (*keys_)[track];
+  }
+
+  void insert(size_t track) {
+    std::string_view path = keyAt(track);
+    uint64_t hash = hashPath(path);
+    for (size_t i = hash & mask_; ; i = (i + 1) & mask_) {
+      Slot& slot = slots_[i];
+      if (slot.track == kEmpty) {
+        slot.hash = hash;
+        slot.track = track;
+        size_++;
+        return;
+      }
+      if (slot.hash == hash && keyAt(slot.track) == path) {
+        // The key occurs more than once (e.g. the database lists a path twice). The last one
+        // wins.
+        slot.track = track;
+        return;
+      }
+    }
+  }
+
+  const std::vector<std::shared_ptr<Track>>* tracks_ = nullptr;
+  const std::vector<std::string>* keys_ = nullptr;
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+
+#include "track_indexes.h"
+
+TrackBitmap::TrackBitmap(size_t track_count, bool value)
+    : words_((track_count + 63) / 64, value ? ~uint64_t(0) : 0), track_count_(track_count) {
+  if (value && track_count % 64 != 0) {
+    words_.back() = (uint64_t(1) << (track_count % 64)) - 1;
+  }
+}
+
+size_t TrackBitmap::count() const {
+  size_t ret = 0;
+  for (uint64_t word : words_) {
+    ret += __builtin_popcountll(word);
+  }
+  return ret;
+}
+
+std::vector<size_t> TrackBitmap::positions() const {
+  std::vector<size_t> ret;
+  for (size_t i = 0; i < words_.size(); i++) {
+    for (uint64_t word = words_[i]; word != 0; word &= word - 1) {
+      ret.push_back(i * 64 + __builtin_ctzll(word));
+    }
+  }
+  return ret;
+}
+
+TrackBitmap& TrackBitmap::operator&=(const TrackBitmap& other) {
+  for (size_t i = 0; i < words_.size(); i++) {
+    words_[i] &= other.words_[i];
+  }
+  return *this;
+}
+
+TrackBitmap& TrackBitmap::operator|=(const TrackBitmap& other) {
+  for (size_t i = 0; i < words_.size(); i++) {
+    words_[i] |= other.words_[i];
+  }
+  return *this;
+}
+
+TrackBitmap& TrackBitmap::andNot(const TrackBitmap& other) {
+  for (size_t i = 0; i < words_.size(); i++) {
+    words_[i] &= ~other.words_[i];
+  }
+  return *this;
+}
+
+TrackBitmap& TrackBitmap::flip() {
+  for (uint64_t& word : words_) {
+    word = ~word;
+  }
+  if (track_count_ % 64 != 0) {
+    words_.back() &= (uint64_t(1) << (track_count_ % 64)) - 1;
+  }
+  return *this;
+}
+
+
+ColumnIndex::ColumnIndex(const std::vector<double>& values) : track_count_(values.size()) {
+  for (uint32_t i = 0; i < values.size(); i++) {
+    if (!std::isnan(values[i])) {
+      positions_.push_back(i);
+    }
+  }
+  std::stable_sort(positions_.begin(), positions_.end(), [&](uint32_t a, uint32_t b) {
+    return values[a] < values[b];
+  });
+  values_.reserve(positions_.size());
+  for (uint32_t pos : positions_) {
+    values_.push_back(values[pos]);
+  }
+}
+
+TrackSpan ColumnIndex::range(double lo, double hi) const {
+  size_t first = std::lower_bound(values_.begin(), values_.end(), lo) - values_.begin();
+  size_t last = std::upper_bound(values_.begin(), values_.end(), hi) - values_.begin();
+  last = std::max(first, last);
+  return TrackSpan{positions_.data() + first, positions_.data() + last};
+}
+
+TrackBitmap ColumnIndex::rangeBitmap(double lo, double hi) const {
+  TrackBitmap ret(track_count_);
+  for (uint32_t pos : range(lo, hi)) {
+    ret.set(pos);
+  }
+  return ret;
+}
+
+size_t ColumnIndex::count(double lo, double hi) const {
+  return range(lo, hi).size();
+}
+
+
+double parseBpm(const std::string& bpm) {
+  char* end = nullptr;
+  double ret = std::strtod(bpm.c_str(), &end);
+  if (end == bpm.c_str() || !(ret > 0)) {
+    return NAN;
+  }
+  return ret;
+}
+
+double parseDuration(const std::string& length) {
+  double ret = 0;
+  const char* p = length.c_str();
+  while (true) {
+    char* end = nullptr;
+    double part = std::strtod(p, &end);
+    if (end == p || part < 0) {
+      return NAN;
+    }
+    ret = ret * 60 + part;
+    if (*end != ':') {
+      break;
+    }
+    p = end + 1;
+  }
+  return ret;
+}
+
+int parseCamelotKey(const std::string& raw_key) {
+  std::string key;
+  for (char c : raw_key) {
+    if (!std::isspace(static_cast<unsigned char>(c))) {
+      key += c;
+    }
+  }
+  if (key.empty()) {
+    return -1;
+  }
+
+  // Camelot ("8A") or Open Key ("1m", "1d").
+  if (std::isdigit(static_cast<unsigned char>(key[0]))) {
+    char* end = nullptr;
+    long number = std::strtol(key.c_str(), &end, 10);
+    if (number < 1 || number > 12 || std::string(end).size() != 1) {
+      return -1;
+    }
+    char letter = std::tolower(static_cast<unsigned char>(*end));
+    if (letter == 'a' || letter == 'b') {
+      return (number - 1) * 2 + (letter == 'b');
+    }
+    if (letter == 'm' || letter == 'd') {
+      return (number + 6) % 12 * 2 + (letter == 'd');
+    }
+    return -1;
+  }
+
+  // Musical notation: a note, an optional accidental, and an optional minor marker.
+  static const int kNotePitchClasses[] = {9, 11, 0, 2, 4, 5, 7};  // A through G.
+  char note = std::toupper(static_cast<unsigned char>(key[0]));
+  if (note < 'A' || note > 'G') {
+    return -1;
+  }
+  int pitch_class = kNotePitchClasses[note - 'A'];
+  size_t pos = 1;
+  if (pos < key.size() && (key[pos] == '#' || key[pos] == 'b')) {
+    pitch_class += key[pos] == '#' ? 1 : 11;
+    pos++;
+  }
+  pitch_class %= 12;
+  std::string rest = key.substr(pos);
+  bool minor = rest == "m" || rest == "min" || rest == "minor";
+  if (!minor && !rest.empty() && rest != "maj" && rest != "major") {
+    return -1;
+  }
+
+  // Camelot numbers, indexed by pitch class starting from C.
+  static const int kMinorCamelot[] = {5, 12, 7, 2, 9, 4, 11, 6, 1, 8, 3, 10};
+  static const int kMajorCamelot[] = {8, 3, 10, 5, 12, 7, 2, 9, 4, 11, 6, 1};
+  int number = minor ? kMinorCamelot[pitch_class] : kMajorCamelot[pitch_class];
+  return (number - 1) * 2 + (minor ? 0 : 1);
+}
+
+std::vector<int> compatibleCamelotKeys(int camelot_key) {
+  if (camelot_key < 0 || camelot_key >= 24) {
+    return {};
+  }
+  int number = camelot_key / 2;
+  int letter = camelot_key % 2;
+  return {
+    camelot_key,
+    (number + 11) % 12 * 2 + letter,
+    (number + 1) % 12 * 2 + letter,
+    number * 2 + (1 - letter),
+  };
+}
+
+
+namespace {
+
+template<typename F>
+ColumnIndex buildColumn(const Library& library, F value) {
+  std::vector<double> values;
+  values.reserve(library.tracks.size());
+  for (const std::shared_ptr<Track>& track : library.tracks) {
+    values.push_back(value(*track));
+  }
+  return ColumnIndex(values);
+}
+
+}  // namespace
+
+TrackIndexes::TrackIndexes(const Library& library)
+    : bpm(buildColumn(library, [](const Track& t) { return parseBpm(t.bpm); })),
+      key(buildColumn(library, [](const Track& t) {
+        int key = parseCamelotKey(t.key);
+        return key < 0 ? NAN : key;
+      })),
+      duration(buildColumn(library, [](const Track& t) { return parseDuration(t.length); })),
+      date_added(buildColumn(library, [](const Track& t) {
+        return t.date_added == 0 ? NAN : static_cast<double>(t.date_added);
+      })) {}
+
+TrackBitmap TrackIndexes::keys(const std::vector<int>& camelot_keys) const {
+  TrackBitmap ret(key.trackCount());
+  for (int camelot_key : camelot_keys) {
+    for (uint32_t pos : key.range(camelot_key, camelot_key)) {
+      ret.set(pos);
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,127 @@
+// This file contains sorted column indexes over a Library's tracks, for range queries on BPM, key,
+// duration and date added.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "seratocrates.h"
+
+// A set of positions in Library::tracks, stored as one bit per track.
+class TrackBitmap {
+public:
+  TrackBitmap() = default;
+  explicit TrackBitmap(size_t track_count, bool value = false);
+
+  size_t trackCount() const {
+    return track_count_;
+  }
+
+  bool test(size_t pos) const {
+    return words_[pos / 64] >> (pos % 64) & 1;
+  }
+
+  void set(size_t pos) {
+    words_[pos / 64] |= uint64_t(1) << (pos % 64);
+  }
+
+  size_t count() const;
+
+  // Returns the positions that are set, in ascending order.
+  std::vector<size_t> positions() const;
+
+  // These require both bitmaps to have the same trackCount().
+  TrackBitmap& operator&=(const TrackBitmap& other);
+  TrackBitmap& operator|=(const TrackBitmap& other);
+  // Removes the positions that are set in other.
+  TrackBitmap& andNot(const TrackBitmap& other);
+  // Sets exactly the positions that aren't set.
+  TrackBitmap& flip();
+
+  const std::vector<uint64_t>& words() const {
+    return words_;
+  }
+
+private:
+  std::vector<uint64_t> words_;
+  size_t track_count_ = 0;
+};
+
+// A contiguous run of positions in Library::tracks returned by ColumnIndex::range. It points into
+// the index, so it's only valid as long as the index is.
+struct TrackSpan {
+  const uint32_t* first;
+  const uint32_t* last;
+
+  const uint32_t* begin() const {
+    return first;
+  }
+  const uint32_t* end() const {
+    return last;
+  }
+  size_t size() const {
+    return last - first;
+  }
+};
+
+// A sorted index over one numeric attribute of each track. Tracks without a value for the
+// attribute aren't in the index.
+class ColumnIndex {
+public:
+  ColumnIndex() = default;
+  // values[i] is the value for track i. NaN means the track has no value.
+  explicit ColumnIndex(const std::vector<double>& values);
+
+  // Returns the tracks with lo <= value <= hi, ordered by value. This is two binary searches.
+  TrackSpan range(double lo, double hi) const;
+
+  // Same as range, as a bitmap.
+  TrackBitmap rangeBitmap(double lo, double hi) const;
+
+  // Returns range(lo, hi).size() without building anything.
+  size_t count(double lo, double hi) const;
+
+  size_t trackCount() const {
+    return track_count_;
+  }
+
+private:
+  std::vector<double> values_;
+  std::vector<uint32_t> positions_;
+  size_t track_count_ = 0;
+};
+
+// Converts Track::bpm to a number. Returns NaN if it's missing or malformed.
+double parseBpm(const std::string& bpm);
+
+// Converts Track::length ("mm:ss.xx", "h:mm:ss" or plain seconds) to seconds. Returns NaN if it's
+// missing or malformed.
+double parseDuration(const std::string& length);
+
+// Converts Track::key to a position on the Camelot wheel: (number - 1) * 2 for minor ("A") keys and
+// (number - 1) * 2 + 1 for major ("B") keys, so 0 is 1A and 23 is 12B. Accepts musical notation
+// ("Am", "F#", "Bbmin"), Camelot ("8A") and Open Key ("1m"). Returns -1 if the key isn't
+// recognized.
+int parseCamelotKey(const std::string& key);
+
+// Returns the Camelot keys that mix harmonically with camelot_key (as returned by
+// parseCamelotKey): itself, one step either way around the wheel, and its relative major/minor.
+std::vector<int> compatibleCamelotKeys(int camelot_key);
+
+// Column indexes over all the tracks in a Library, built once per load. Positions refer to
+// Library::tracks of the library passed to the constructor.
+struct TrackIndexes {
+  explicit TrackIndexes(const Library& library);
+
+  ColumnIndex bpm;
+  // Values are parseCamelotKey results.
+  ColumnIndex key;
+  // Seconds.
+  ColumnIndex duration;
+  // Seconds since the Unix epoch.
+  ColumnIndex date_added;
+
+  // Tracks whose key is any of camelot_keys.
+  TrackBitmap keys(const std::vector<int>& camelot_keys) const;
+};